@@ -0,0 +1,450 @@
+/*
+ * bench.c
+ * @brief SPIFS性能基准测试
+ * 基于w25q32模拟器时序模型的虚拟时钟计时, 固定随机种子, 多次运行结果一致
+ * 输出CSV: name,files,fill_pct,ops,bytes,total_us,avg_us,min_us,max_us,kib_per_s,reads,programs,erases,block_erases
+ * 操作失败时该行ops字段为FAIL, 并在stderr输出失败前完成的操作数和Result
+ */
+
+#include <stdio.h>
+#include "spifs.h"
+#include "w25q32.h"
+#include "common_def.h"
+
+#ifndef W25Q32_USE_TIMING
+#error "bench需要启用W25Q32_USE_TIMING时序模型, 请使用make bench构建"
+#endif
+
+// 固定随机种子
+#define BENCH_SEED          (0x5EED)
+// 文件扩展名
+#define BENCH_EXT           ("dat")
+// 填充文件单个大小(扇区数)
+#define FILLER_SECTORS      (32)
+// 读缓存测试的数据页缓存页数
+#define BENCH_CACHE_PAGES   (16)
+
+/**
+ * @brief 单项测试统计
+ */
+typedef struct _bench_stat {
+    const char *name;
+    uint32_t files;
+    uint32_t fill_pct;
+    uint32_t ops;
+    uint64_t bytes;
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t op_start;
+    BOOL failed;
+    Result result;
+    W25q32Stats flash;
+} BenchStat;
+
+static uint32_t rand_state = BENCH_SEED;
+// bench_make最近一次失败的Result
+static Result make_result;
+
+static uint32_t bench_rand(void);
+static void bench_name(char *name, uint32_t prefix, uint32_t index);
+static void bench_begin(BenchStat *st, const char *name, uint32_t files, uint32_t fill_pct);
+static void op_begin(BenchStat *st);
+static void op_end(BenchStat *st, uint32_t bytes);
+static void op_fail(BenchStat *st, Result result);
+static void bench_report(BenchStat *st);
+static void bench_mount(uint32_t fill_pct);
+static BOOL bench_make(File *file, uint32_t prefix, uint32_t index, uint8_t *buffer, uint32_t length);
+
+static void bench_seq_write(uint32_t fill_pct, uint32_t length);
+static void bench_append(uint32_t fill_pct, uint32_t record, uint32_t count);
+static void bench_random_read(uint32_t fill_pct, uint32_t length, uint32_t record, uint32_t count);
+static void bench_patch(uint32_t fill_pct, uint32_t length, uint32_t record, uint32_t count);
+static void bench_open(const char *name, uint32_t files, uint32_t count);
+static void bench_churn(const char *name, uint32_t fill_pct, uint32_t length, uint32_t count);
+static void bench_mount_scan(uint32_t files);
+static void bench_format(uint32_t fill_pct);
+
+static uint8_t data_buffer[256 * 1024];
+
+static spifs_t fs;
+
+int main(int argc, char **argv) {
+    uint32_t fill, capacity;
+    uint32_t fills[] = {0, 50, 90};
+    uint32_t i;
+    SpifsConfig cfg;
+
+    w25q32_allocate();
+    spifs_default_config(&cfg);
+    spifs_init(&fs, &cfg);
+    for(i = 0; i < sizeof(data_buffer); i++) {
+        data_buffer[i] = (uint8_t)bench_rand();
+    }
+
+    spifs_format(&fs);
+    spifs_ftl_init(&fs);
+    capacity = spifs_avail_files(&fs);
+
+    printf("name,files,fill_pct,ops,bytes,total_us,avg_us,min_us,max_us,kib_per_s,reads,programs,erases,block_erases\n");
+
+    for(i = 0; i < sizeof(fills) / sizeof(fills[0]); i++) {
+        fill = fills[i];
+        bench_seq_write(fill, 4 * 1024);
+        bench_seq_write(fill, 64 * 1024);
+        bench_seq_write(fill, 256 * 1024);
+        bench_append(fill, 32, 1000);
+        bench_random_read(fill, 256 * 1024, 64, 1000);
+        bench_patch(fill, 200 * 1024, 16, 200);
+        bench_churn("create_delete", fill, 100, 500);
+    }
+
+    bench_open("open_by_name", 16, 1000);
+    bench_open("open_by_name", 128, 1000);
+    bench_open("open_by_name", capacity, 1000);
+
+    bench_mount_scan(16);
+    bench_mount_scan(capacity);
+
+    bench_format(0);
+    bench_format(90);
+
+    // 启用读缓存: 文件索引区常驻RAM + 数据页缓存
+    spifs_unmount(&fs);
+    cfg.cache_fb = TRUE;
+    cfg.cache_pages = BENCH_CACHE_PAGES;
+    spifs_init(&fs, &cfg);
+    bench_open("open_by_name_cached", capacity, 1000);
+    bench_churn("create_delete_cached", 50, 100, 500);
+
+    spifs_unmount(&fs);
+    w25q32_destory();
+    return 0;
+}
+
+/**
+ * @brief 格式化并挂载, 填充数据区至fill_pct%
+ * @param fill_pct 数据区填充百分比
+ * */
+static void bench_mount(uint32_t fill_pct) {
+    File file;
+    uint32_t index = 0, target;
+
+    spifs_format(&fs);
+    spifs_ftl_init(&fs);
+
+    target = (fs.data_sectors * fill_pct) / 100;
+    while(fs.data_sectors - spifs_avail_sector(&fs) + FILLER_SECTORS <= target) {
+        if(!bench_make(&file, 'f', index++, data_buffer, FILLER_SECTORS * DATA_AREA_SIZE)) {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief 创建文件并写入数据, 不计时
+ * @return 成功TRUE
+ * */
+static BOOL bench_make(File *file, uint32_t prefix, uint32_t index, uint8_t *buffer, uint32_t length) {
+    char name[FILENAME_SIZE + 1];
+    FileInfo finfo;
+
+    bench_name(name, prefix, index);
+    make_finfo(&finfo, 2021, 1, 1, FSTATE_DEFAULT);
+    make_file(file, name, BENCH_EXT);
+    if((make_result = create_file(&fs, file, &finfo)) != CREATE_FILE_SUCCESS) {
+        return FALSE;
+    }
+    if(length > 0) {
+        return ((make_result = write_file(&fs, file, buffer, length, OVERRIDE)) == WRITE_FILE_SUCCESS);
+    }
+    return TRUE;
+}
+
+/**
+ * @brief 顺序写: 新建文件一次写入length字节
+ * */
+static void bench_seq_write(uint32_t fill_pct, uint32_t length) {
+    BenchStat st;
+    File file;
+    uint32_t i;
+    char name[FILENAME_SIZE + 1];
+    FileInfo finfo;
+    Result result;
+
+    bench_mount(fill_pct);
+    make_finfo(&finfo, 2021, 1, 1, FSTATE_DEFAULT);
+    bench_begin(&st, (length >= 64 * 1024) ? ((length >= 256 * 1024) ? "seq_write_256k" : "seq_write_64k") : "seq_write_4k", 1, fill_pct);
+    for(i = 0; i < 8; i++) {
+        bench_name(name, 's', i);
+        make_file(&file, name, BENCH_EXT);
+        op_begin(&st);
+        if(((result = create_file(&fs, &file, &finfo)) != CREATE_FILE_SUCCESS)
+                || ((result = write_file(&fs, &file, data_buffer, length, OVERRIDE)) != WRITE_FILE_SUCCESS)) {
+            op_fail(&st, result);
+            break;
+        }
+        op_end(&st, length);
+        delete_file(&fs, &file);
+    }
+    bench_report(&st);
+}
+
+/**
+ * @brief 小记录追加: 每次追加record字节, 共count次, 最后write_finish
+ * */
+static void bench_append(uint32_t fill_pct, uint32_t record, uint32_t count) {
+    BenchStat st;
+    File file;
+    uint32_t i;
+    Result result;
+
+    bench_mount(fill_pct);
+    bench_make(&file, 'a', 0, NULL, 0);
+    bench_begin(&st, "append_small", 1, fill_pct);
+    for(i = 0; i < count; i++) {
+        op_begin(&st);
+        if((result = write_file(&fs, &file, data_buffer + (i * record) % (sizeof(data_buffer) - record), record, APPEND)) != APPEND_FILE_SUCCESS) {
+            op_fail(&st, result);
+            break;
+        }
+        op_end(&st, record);
+    }
+    op_begin(&st);
+    write_finish(&fs, &file);
+    op_end(&st, 0);
+    bench_report(&st);
+}
+
+/**
+ * @brief 随机读: 在length字节的文件中随机读取record字节, 共count次
+ * */
+static void bench_random_read(uint32_t fill_pct, uint32_t length, uint32_t record, uint32_t count) {
+    BenchStat st;
+    File file;
+    uint32_t i, offset;
+    uint8_t buffer[256];
+
+    bench_mount(fill_pct);
+    if(!bench_make(&file, 'r', 0, data_buffer, length)) {
+        return;
+    }
+    bench_begin(&st, "random_read", 1, fill_pct);
+    for(i = 0; i < count; i++) {
+        offset = bench_rand() % (length - record);
+        op_begin(&st);
+        read_file(&fs, &file, offset, buffer, record);
+        op_end(&st, record);
+    }
+    bench_report(&st);
+}
+
+/**
+ * @brief 随机偏移覆盖写: 在length字节的文件中随机位置改写record字节, 共count次
+ * */
+static void bench_patch(uint32_t fill_pct, uint32_t length, uint32_t record, uint32_t count) {
+    BenchStat st;
+    File file;
+    uint32_t i, offset;
+    Result result;
+
+    bench_mount(fill_pct);
+    if(!bench_make(&file, 'p', 0, data_buffer, length)) {
+        return;
+    }
+    bench_begin(&st, "patch_write_at", 1, fill_pct);
+    for(i = 0; i < count; i++) {
+        offset = bench_rand() % (length - record);
+        op_begin(&st);
+        if((result = write_file_at(&fs, &file, offset, data_buffer + (bench_rand() % (sizeof(data_buffer) - record)), record)) != WRITE_FILE_SUCCESS) {
+            op_fail(&st, result);
+            break;
+        }
+        op_end(&st, record);
+    }
+    bench_report(&st);
+}
+
+/**
+ * @brief 按文件名打开: 创建files个文件, 随机打开count次
+ * */
+static void bench_open(const char *name, uint32_t files, uint32_t count) {
+    BenchStat st;
+    File file;
+    uint32_t i, created = 0;
+    char fname[FILENAME_SIZE + 1];
+
+    bench_mount(0);
+    for(i = 0; i < files; i++) {
+        if(!bench_make(&file, 'o', i, data_buffer, 16)) {
+            break;
+        }
+        created++;
+    }
+    bench_begin(&st, name, created, 0);
+    for(i = 0; i < count; i++) {
+        bench_name(fname, 'o', bench_rand() % created);
+        op_begin(&st);
+        open_file(&fs, &file, fname, BENCH_EXT);
+        op_end(&st, 0);
+    }
+    bench_report(&st);
+}
+
+/**
+ * @brief 创建/删除循环: 创建文件写入length字节后删除, 共count次, 包含触发的GC
+ * */
+static void bench_churn(const char *name, uint32_t fill_pct, uint32_t length, uint32_t count) {
+    BenchStat st;
+    File file;
+    uint32_t i;
+
+    bench_mount(fill_pct);
+    bench_begin(&st, name, 1, fill_pct);
+    for(i = 0; i < count; i++) {
+        op_begin(&st);
+        if(!bench_make(&file, 'c', i % 1000, data_buffer, length)) {
+            op_fail(&st, make_result);
+            break;
+        }
+        delete_file(&fs, &file);
+        op_end(&st, length);
+    }
+    bench_report(&st);
+}
+
+/**
+ * @brief 挂载扫描: 创建files个文件后计时spifs_ftl_init, 再写入检查点后计时
+ * @brief 最后使检查点失效, 计时延迟挂载 + 首次打开文件
+ * */
+static void bench_mount_scan(uint32_t files) {
+    BenchStat st;
+    File file;
+    uint32_t i, created = 0;
+    char name[FILENAME_SIZE + 1];
+
+    bench_mount(0);
+    for(i = 0; i < files; i++) {
+        if(!bench_make(&file, 'm', i, data_buffer, 16)) {
+            break;
+        }
+        created++;
+    }
+    bench_begin(&st, "ftl_init", created, 0);
+    for(i = 0; i < 4; i++) {
+        op_begin(&st);
+        spifs_ftl_init(&fs);
+        op_end(&st, 0);
+    }
+    bench_report(&st);
+
+    // 写入检查点后挂载只需载入检查点
+    if(!spifs_checkpoint(&fs)) {
+        return;
+    }
+    bench_begin(&st, "ftl_init_ckpt", created, 0);
+    for(i = 0; i < 4; i++) {
+        op_begin(&st);
+        spifs_ftl_init(&fs);
+        op_end(&st, 0);
+    }
+    bench_report(&st);
+
+    // 写入数据使检查点失效, 延迟挂载只载入打开文件所需的部分
+    bench_make(&file, 'l', 0, data_buffer, 16);
+    bench_begin(&st, "ftl_init_lazy", created, 0);
+    fs.lazy_mount = TRUE;
+    for(i = 0; i < 4; i++) {
+        bench_name(name, 'm', bench_rand() % created);
+        op_begin(&st);
+        spifs_ftl_init(&fs);
+        open_file(&fs, &file, name, BENCH_EXT);
+        op_end(&st, 0);
+    }
+    fs.lazy_mount = FALSE;
+    spifs_ftl_init(&fs);
+    bench_report(&st);
+}
+
+/**
+ * @brief 格式化: 数据区填充fill_pct%后整区擦除, 对齐整块使用块擦除
+ * */
+static void bench_format(uint32_t fill_pct) {
+    BenchStat st;
+
+    bench_mount(fill_pct);
+    bench_begin(&st, "format", 0, fill_pct);
+    op_begin(&st);
+    spifs_format(&fs);
+    op_end(&st, (fs.data_sectors * SECTOR_SIZE));
+    bench_report(&st);
+    spifs_ftl_init(&fs);
+}
+
+static uint32_t bench_rand(void) {
+    rand_state = rand_state * 1103515245 + 12345;
+    return (rand_state >> 8);
+}
+
+static void bench_name(char *name, uint32_t prefix, uint32_t index) {
+    snprintf(name, FILENAME_SIZE + 1, "%c%06u", (char)prefix, (index % 1000000));
+}
+
+static void bench_begin(BenchStat *st, const char *name, uint32_t files, uint32_t fill_pct) {
+    os_memset(st, 0, sizeof(BenchStat));
+    st->name = name;
+    st->files = files;
+    st->fill_pct = fill_pct;
+    st->min_ns = (uint64_t)-1;
+    w25q32_stats_reset();
+}
+
+static void op_begin(BenchStat *st) {
+    st->op_start = w25q32_clock();
+}
+
+static void op_end(BenchStat *st, uint32_t bytes) {
+    uint64_t elapsed = w25q32_clock() - st->op_start;
+
+    st->ops++;
+    st->bytes += bytes;
+    st->total_ns += elapsed;
+    st->min_ns = (elapsed < st->min_ns) ? elapsed : st->min_ns;
+    st->max_ns = (elapsed > st->max_ns) ? elapsed : st->max_ns;
+}
+
+/**
+ * @brief 记录操作失败, 报告时该行标记为FAIL
+ * */
+static void op_fail(BenchStat *st, Result result) {
+    st->failed = TRUE;
+    st->result = result;
+}
+
+static void bench_report(BenchStat *st) {
+    uint64_t kibps = 0;
+    char ops[12];
+
+    w25q32_stats_get(&st->flash);
+    if(st->ops == 0) {
+        st->min_ns = 0;
+    }
+    if(st->total_ns > 0) {
+        kibps = (st->bytes * 1000000000ULL) / st->total_ns / 1024;
+    }
+    if(st->failed) {
+        fprintf(stderr, "%s,%u,%u: failed after %u ops, result=%d\n", st->name, st->files, st->fill_pct, st->ops, (int)st->result);
+        snprintf(ops, sizeof(ops), "FAIL");
+    }else {
+        snprintf(ops, sizeof(ops), "%u", st->ops);
+    }
+    printf("%s,%u,%u,%s,%llu,%llu,%llu,%llu,%llu,%llu,%u,%u,%u,%u\n",
+            st->name, st->files, st->fill_pct, ops,
+            (unsigned long long)st->bytes,
+            (unsigned long long)(st->total_ns / 1000),
+            (unsigned long long)(st->ops ? (st->total_ns / st->ops / 1000) : 0),
+            (unsigned long long)(st->min_ns / 1000),
+            (unsigned long long)(st->max_ns / 1000),
+            (unsigned long long)kibps,
+            st->flash.read_cmds, st->flash.program_cmds, st->flash.sector_erases, st->flash.block_erases);
+}
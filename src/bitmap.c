@@ -0,0 +1,90 @@
+#include "bitmap.h"
+
+/**
+ * @brief 计算尾部0的个数, value不能为0
+ * */
+uint32_t ICACHE_FLASH_ATTR bitmap_ctz(uint32_t value) {
+#ifdef __GNUC__
+    return (uint32_t)__builtin_ctz(value);
+#else
+    uint32_t n = 0;
+    if(!(value & 0xFFFF)) { value >>= 16; n += 16; }
+    if(!(value & 0xFF)) { value >>= 8; n += 8; }
+    if(!(value & 0xF)) { value >>= 4; n += 4; }
+    if(!(value & 0x3)) { value >>= 2; n += 2; }
+    return (n + !(value & 0x1));
+#endif
+}
+
+/**
+ * @brief 统计置位数量
+ * @param *map Bitmap
+ * @param words 字数, 尾部无效位需保持为0
+ * @return 置位数量
+ * */
+uint32_t ICACHE_FLASH_ATTR bitmap_popcount(const uint32_t *map, uint32_t words) {
+    uint32_t i, value, count = 0;
+
+    for(i = 0; i < words; i++) {
+        value = map[i];
+#ifdef __GNUC__
+        count += (uint32_t)__builtin_popcount(value);
+#else
+        value = value - ((value >> 1) & 0x55555555);
+        value = (value & 0x33333333) + ((value >> 2) & 0x33333333);
+        count += ((((value + (value >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24);
+#endif
+    }
+    return count;
+}
+
+/**
+ * @brief 查找from及之后的第一个置位
+ * @param *map Bitmap
+ * @param bits 有效位数
+ * @param from 起始位编号
+ * @return 位编号, 不存在返回BITMAP_NONE
+ * */
+uint32_t ICACHE_FLASH_ATTR bitmap_next_set(const uint32_t *map, uint32_t bits, uint32_t from) {
+    uint32_t index, value, bit;
+
+    if(from >= bits) {
+        return BITMAP_NONE;
+    }
+    index = (from >> 5);
+    // 屏蔽起始字中from之前的位
+    value = map[index] & ~(((uint32_t)0x1 << (from & 0x1F)) - 1);
+    while(value == 0) {
+        if(++index >= BITMAP_WORDS(bits)) {
+            return BITMAP_NONE;
+        }
+        value = map[index];
+    }
+    bit = (index << 5) + bitmap_ctz(value);
+    return (bit < bits) ? bit : BITMAP_NONE;
+}
+
+/**
+ * @brief 将[first, first + count)区间的位全部置1或清0, 首尾不足一字的部分使用掩码
+ * @param *map Bitmap
+ * @param first 起始位编号
+ * @param count 位数
+ * @param bitValue only 0 or 1
+ * */
+void ICACHE_FLASH_ATTR bitmap_fill(uint32_t *map, uint32_t first, uint32_t count, uint32_t bitValue) {
+    uint32_t index, mask, width;
+
+    while(count > 0) {
+        index = (first >> 5);
+        width = BITS_OF_INTEGER - (first & 0x1F);
+        width = (count < width) ? count : width;
+        mask = (width == BITS_OF_INTEGER) ? 0xFFFFFFFF : ((((uint32_t)0x1 << width) - 1) << (first & 0x1F));
+        if(bitValue) {
+            map[index] |= mask;
+        }else {
+            map[index] &= ~mask;
+        }
+        first += width;
+        count -= width;
+    }
+}
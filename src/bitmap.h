@@ -0,0 +1,31 @@
+/*
+ * bitmap.h
+ * @brief 32位字Bitmap操作
+ * 按字处理: 统计置位数量、查找下一个置位、批量设置区间, 避免逐位除法/取模
+ */
+
+#ifndef _BITMAP_H_
+#define _BITMAP_H_
+
+#include "common_def.h"
+
+// 查找失败返回值
+#define BITMAP_NONE           (0xFFFFFFFF)
+
+// Bitmap位数对应的字数
+#define BITMAP_WORDS(bits)    (((bits) + BITS_OF_INTEGER - 1) / BITS_OF_INTEGER)
+
+// 读取/设置单个位, bit为位编号
+#define BITMAP_GET(map, bit)     (((map)[(bit) >> 5] >> ((bit) & 0x1F)) & 0x1)
+#define BITMAP_SET(map, bit)     ((map)[(bit) >> 5] |= ((uint32_t)0x1 << ((bit) & 0x1F)))
+#define BITMAP_CLEAR(map, bit)   ((map)[(bit) >> 5] &= ~((uint32_t)0x1 << ((bit) & 0x1F)))
+
+uint32_t ICACHE_FLASH_ATTR bitmap_ctz(uint32_t value);
+
+uint32_t ICACHE_FLASH_ATTR bitmap_popcount(const uint32_t *map, uint32_t words);
+
+uint32_t ICACHE_FLASH_ATTR bitmap_next_set(const uint32_t *map, uint32_t bits, uint32_t from);
+
+void ICACHE_FLASH_ATTR bitmap_fill(uint32_t *map, uint32_t first, uint32_t count, uint32_t bitValue);
+
+#endif
@@ -0,0 +1,256 @@
+#include "cache.h"
+#include "diskio.h"
+#include "bitmap.h"
+
+#ifdef SPIFS_USE_CACHE
+
+// 缓存互斥: 持读锁的多个API并发读取时保护缓存内容与命中统计, 持写锁时无其他任务访问
+#ifdef SPIFS_USE_LOCK
+#define CACHE_LOCK(fs)      do { if((fs)->lock_ops != NULL && (fs)->lock_ops->mutex_lock != NULL) (fs)->lock_ops->mutex_lock((fs)->lock); } while(0)
+#define CACHE_UNLOCK(fs)    do { if((fs)->lock_ops != NULL && (fs)->lock_ops->mutex_unlock != NULL) (fs)->lock_ops->mutex_unlock((fs)->lock); } while(0)
+#else
+#define CACHE_LOCK(fs)
+#define CACHE_UNLOCK(fs)
+#endif
+
+#define CACHE_FB_BASE(fs)       ((fs)->fb_start * SECTOR_SIZE)
+#define CACHE_FB_LIMIT(fs)      (((fs)->fb_end + 1) * SECTOR_SIZE)
+#define CACHE_FB_SECTORS(fs)    ((fs)->fb_end - (fs)->fb_start + 1)
+#define CACHE_PAGE_BASE(addr)   ((addr) & ~(uint32_t)(CACHE_PAGE_SIZE - 1))
+
+static uint32_t ICACHE_FLASH_ATTR cache_page_slot(spifs_t *fs, uint32_t page);
+
+static SpiFlashOpResult ICACHE_FLASH_ATTR cache_read_impl(spifs_t *fs, uint32_t addr, uint32_t *buffer, uint32_t size);
+
+static void ICACHE_FLASH_ATTR cache_program(spifs_t *fs, uint32_t addr, const uint8_t *src, uint32_t size);
+
+/**
+ * @brief 按配置分配读缓存, 分配后缓存为空
+ * @param fb TRUE: 缓存整个文件索引区, RAM占用为文件索引区大小
+ * @param pages 数据页缓存页数, 0:不缓存, RAM占用: pages * (CACHE_PAGE_SIZE + 8) 字节
+ * @return 成功TRUE, 内存不足FALSE(已分配部分由cache_free释放)
+ * */
+BOOL ICACHE_FLASH_ATTR cache_alloc(spifs_t *fs, BOOL fb, uint32_t pages) {
+    uint32_t i;
+
+    os_memset(&fs->cache_stats, 0x00, sizeof(SpifsCacheStats));
+    fs->cache_tick = 0;
+    fs->cache_pages = 0;
+    if(fb) {
+        // cache_fb: 文件索引区扇区数据, 与flash扇区一一对应
+        // cache_fb_valid: 1:扇区已载入, 0:首次读取时整扇区载入
+        fs->cache_fb = (uint8_t *)os_malloc(CACHE_FB_SECTORS(fs) * SECTOR_SIZE);
+        fs->cache_fb_valid = (uint32_t *)os_malloc(BITMAP_WORDS(CACHE_FB_SECTORS(fs)) * sizeof(uint32_t));
+        if(fs->cache_fb == NULL || fs->cache_fb_valid == NULL) {
+            return FALSE;
+        }
+        os_memset(fs->cache_fb_valid, 0x00, BITMAP_WORDS(CACHE_FB_SECTORS(fs)) * sizeof(uint32_t));
+    }
+    if(pages > 0) {
+        // cache_tag: 页首地址, EMPTY_INT_VALUE表示空闲
+        // cache_stamp: 最近使用时刻, 淘汰时选择最小值
+        fs->cache_tag = (uint32_t *)os_malloc(pages * sizeof(uint32_t));
+        fs->cache_stamp = (uint32_t *)os_malloc(pages * sizeof(uint32_t));
+        fs->cache_data = (uint8_t *)os_malloc(pages * CACHE_PAGE_SIZE);
+        if(fs->cache_tag == NULL || fs->cache_stamp == NULL || fs->cache_data == NULL) {
+            return FALSE;
+        }
+        for(i = 0; i < pages; i++) {
+            fs->cache_tag[i] = EMPTY_INT_VALUE;
+            fs->cache_stamp[i] = 0;
+        }
+        fs->cache_pages = pages;
+    }
+    return TRUE;
+}
+
+void ICACHE_FLASH_ATTR cache_free(spifs_t *fs) {
+    os_free(fs->cache_fb);
+    os_free(fs->cache_fb_valid);
+    os_free(fs->cache_tag);
+    os_free(fs->cache_stamp);
+    os_free(fs->cache_data);
+    fs->cache_fb = NULL;
+    fs->cache_fb_valid = NULL;
+    fs->cache_tag = NULL;
+    fs->cache_stamp = NULL;
+    fs->cache_data = NULL;
+    fs->cache_pages = 0;
+}
+
+/**
+ * @brief 经缓存读flash
+ * @brief 文件索引区读取由扇区缓存提供; 不跨页的读取由数据页缓存提供, 未命中时载入整页; 其余直接读flash
+ * @param addr flash地址, 四字节边界
+ * @param *buffer 读出数据缓冲区
+ * @param size 读取长度, 四字节对齐
+ * */
+SpiFlashOpResult ICACHE_FLASH_ATTR cache_read(spifs_t *fs, uint32_t addr, uint32_t *buffer, uint32_t size) {
+    SpiFlashOpResult ret;
+
+    CACHE_LOCK(fs);
+    ret = cache_read_impl(fs, addr, buffer, size);
+    CACHE_UNLOCK(fs);
+    return ret;
+}
+
+/**
+ * @brief 经缓存读flash实现, 调用者持有缓存互斥
+ * */
+static SpiFlashOpResult ICACHE_FLASH_ATTR cache_read_impl(spifs_t *fs, uint32_t addr, uint32_t *buffer, uint32_t size) {
+    SpiFlashOpResult ret;
+    uint8_t *dst = (uint8_t *)buffer;
+    uint32_t sec, offset, chunk, slot, page;
+
+    if((fs->cache_fb != NULL) && (addr >= CACHE_FB_BASE(fs)) && ((addr + size) <= CACHE_FB_LIMIT(fs))) {
+        while(size > 0) {
+            sec = ((addr / SECTOR_SIZE) - fs->fb_start);
+            offset = (addr % SECTOR_SIZE);
+            chunk = (SECTOR_SIZE - offset);
+            chunk = (size < chunk) ? size : chunk;
+            if(!BITMAP_GET(fs->cache_fb_valid, sec)) {
+                ret = spifs_ops_read(fs, (addr - offset), (uint32_t *)(fs->cache_fb + sec * SECTOR_SIZE), SECTOR_SIZE);
+                if(ret != SPI_FLASH_RESULT_OK) {
+                    return ret;
+                }
+                BITMAP_SET(fs->cache_fb_valid, sec);
+                fs->cache_stats.fb_misses++;
+            }else {
+                fs->cache_stats.fb_hits++;
+            }
+            os_memcpy(dst, (fs->cache_fb + sec * SECTOR_SIZE + offset), chunk);
+            dst += chunk;
+            addr += chunk;
+            size -= chunk;
+        }
+        return SPI_FLASH_RESULT_OK;
+    }
+
+    page = CACHE_PAGE_BASE(addr);
+    if((fs->cache_pages > 0) && (size > 0) && (CACHE_PAGE_BASE(addr + size - 1) == page)) {
+        slot = cache_page_slot(fs, page);
+        if(fs->cache_tag[slot] != page) {
+            fs->cache_tag[slot] = EMPTY_INT_VALUE;
+            ret = spifs_ops_read(fs, page, (uint32_t *)(fs->cache_data + slot * CACHE_PAGE_SIZE), CACHE_PAGE_SIZE);
+            if(ret != SPI_FLASH_RESULT_OK) {
+                return ret;
+            }
+            fs->cache_tag[slot] = page;
+            fs->cache_stats.page_misses++;
+        }else {
+            fs->cache_stats.page_hits++;
+        }
+        fs->cache_stamp[slot] = ++fs->cache_tick;
+        os_memcpy(dst, (fs->cache_data + slot * CACHE_PAGE_SIZE + (addr - page)), size);
+        return SPI_FLASH_RESULT_OK;
+    }
+
+    fs->cache_stats.bypass++;
+    return spifs_ops_read(fs, addr, buffer, size);
+}
+
+/**
+ * @brief 写flash并同步更新已缓存内容, 写入失败时作废涉及扇区的缓存
+ * */
+SpiFlashOpResult ICACHE_FLASH_ATTR cache_write(spifs_t *fs, uint32_t addr, uint32_t *buffer, uint32_t size) {
+    SpiFlashOpResult ret;
+
+    ret = spifs_ops_write(fs, addr, buffer, size);
+    if(ret != SPI_FLASH_RESULT_OK) {
+        if(size > 0) {
+            cache_invalidate(fs, (addr / SECTOR_SIZE), ((addr + size - 1) / SECTOR_SIZE - addr / SECTOR_SIZE + 1));
+        }
+        return ret;
+    }
+    cache_program(fs, addr, (const uint8_t *)buffer, size);
+    return ret;
+}
+
+/**
+ * @brief 擦除扇区, 文件索引区扇区缓存直接置为0xFF, 数据页缓存作废
+ * @param sec 扇区编号
+ * */
+SpiFlashOpResult ICACHE_FLASH_ATTR cache_erase(spifs_t *fs, uint32_t sec) {
+    SpiFlashOpResult ret;
+
+    ret = spifs_ops_erase(fs, sec);
+    cache_invalidate(fs, sec, 1);
+    if((ret == SPI_FLASH_RESULT_OK) && (fs->cache_fb != NULL) && (sec >= fs->fb_start) && (sec < (fs->fb_end + 1))) {
+        os_memset((fs->cache_fb + (sec - fs->fb_start) * SECTOR_SIZE), 0xFF, SECTOR_SIZE);
+        BITMAP_SET(fs->cache_fb_valid, (sec - fs->fb_start));
+    }
+    return ret;
+}
+
+/**
+ * @brief 作废连续扇区的缓存, 用于后台擦除/块擦除等不经过cache_erase的擦除
+ * @param sec 首扇区编号
+ * @param secs 扇区数量
+ * */
+void ICACHE_FLASH_ATTR cache_invalidate(spifs_t *fs, uint32_t sec, uint32_t secs) {
+    uint32_t i;
+
+    if(fs->cache_fb != NULL) {
+        for(i = sec; i < (sec + secs); i++) {
+            if((i >= fs->fb_start) && (i < (fs->fb_end + 1))) {
+                BITMAP_CLEAR(fs->cache_fb_valid, (i - fs->fb_start));
+            }
+        }
+    }
+    for(i = 0; i < fs->cache_pages; i++) {
+        if((fs->cache_tag[i] != EMPTY_INT_VALUE) && ((fs->cache_tag[i] / SECTOR_SIZE) >= sec)
+                && ((fs->cache_tag[i] / SECTOR_SIZE) < (sec + secs))) {
+            fs->cache_tag[i] = EMPTY_INT_VALUE;
+            fs->cache_stamp[i] = 0;
+        }
+    }
+}
+
+/**
+ * @brief 查找页所在缓存槽位, 未缓存时返回空闲或最久未使用的槽位
+ * @param page 页首地址
+ * @return 槽位编号, cache_tag与page不等时需载入
+ * */
+static uint32_t ICACHE_FLASH_ATTR cache_page_slot(spifs_t *fs, uint32_t page) {
+    uint32_t i, victim = 0;
+
+    for(i = 0; i < fs->cache_pages; i++) {
+        if(fs->cache_tag[i] == page) {
+            return i;
+        }
+        if(fs->cache_stamp[i] < fs->cache_stamp[victim]) {
+            victim = i;
+        }
+    }
+    return victim;
+}
+
+/**
+ * @brief 写入成功后更新缓存, NOR编程只能将1写为0, 缓存内容与写入数据按位与后与flash一致
+ * */
+static void ICACHE_FLASH_ATTR cache_program(spifs_t *fs, uint32_t addr, const uint8_t *src, uint32_t size) {
+    uint32_t i, start, end, base;
+
+    if((fs->cache_fb != NULL) && (addr < CACHE_FB_LIMIT(fs)) && ((addr + size) > CACHE_FB_BASE(fs))) {
+        start = (addr > CACHE_FB_BASE(fs)) ? addr : CACHE_FB_BASE(fs);
+        end = ((addr + size) < CACHE_FB_LIMIT(fs)) ? (addr + size) : CACHE_FB_LIMIT(fs);
+        for(; start < end; start++) {
+            if(BITMAP_GET(fs->cache_fb_valid, (start / SECTOR_SIZE - fs->fb_start))) {
+                fs->cache_fb[start - CACHE_FB_BASE(fs)] &= src[start - addr];
+            }
+        }
+    }
+    for(i = 0; i < fs->cache_pages; i++) {
+        base = fs->cache_tag[i];
+        if((base == EMPTY_INT_VALUE) || (base >= (addr + size)) || ((base + CACHE_PAGE_SIZE) <= addr)) {
+            continue;
+        }
+        start = (addr > base) ? addr : base;
+        end = ((addr + size) < (base + CACHE_PAGE_SIZE)) ? (addr + size) : (base + CACHE_PAGE_SIZE);
+        for(; start < end; start++) {
+            fs->cache_data[i * CACHE_PAGE_SIZE + (start - base)] &= src[start - addr];
+        }
+    }
+}
+
+#endif
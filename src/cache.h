@@ -0,0 +1,30 @@
+/*
+ * cache.h
+ * @brief flash读缓存, 位于文件系统实例的flash操作接口之上, 所有spifs_flash_read调用均经过缓存
+ * 文件索引区缓存: 按扇区整体缓存, 首次读取时载入, 之后常驻RAM
+ * 数据页缓存: 单页内的小块读取(扇区标记字/链表指针/文件块记录等)按页缓存, 满时淘汰最久未使用的页
+ * 写入直写flash并同步更新已缓存内容, 擦除时作废对应扇区的缓存
+ */
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include "common_def.h"
+#include "spifs.h"
+
+// 数据页缓存单页大小, 与页编程边界一致
+#define CACHE_PAGE_SIZE    (256)
+
+BOOL ICACHE_FLASH_ATTR cache_alloc(spifs_t *fs, BOOL fb, uint32_t pages);
+
+void ICACHE_FLASH_ATTR cache_free(spifs_t *fs);
+
+SpiFlashOpResult ICACHE_FLASH_ATTR cache_read(spifs_t *fs, uint32_t addr, uint32_t *buffer, uint32_t size);
+
+SpiFlashOpResult ICACHE_FLASH_ATTR cache_write(spifs_t *fs, uint32_t addr, uint32_t *buffer, uint32_t size);
+
+SpiFlashOpResult ICACHE_FLASH_ATTR cache_erase(spifs_t *fs, uint32_t sec);
+
+void ICACHE_FLASH_ATTR cache_invalidate(spifs_t *fs, uint32_t sec, uint32_t secs);
+
+#endif
@@ -0,0 +1,192 @@
+#include "checkpoint.h"
+#include "bitmap.h"
+
+#ifdef SPIFS_USE_CHECKPOINT
+
+static uint32_t ICACHE_FLASH_ATTR ckpt_crc32(uint32_t crc, const uint8_t *data, uint32_t length);
+
+static uint32_t ICACHE_FLASH_ATTR ckpt_flags(void);
+
+#ifdef SPIFS_USE_WEAR_LEVELING
+static uint32_t ICACHE_FLASH_ATTR ckpt_wear_io(spifs_t *fs, uint32_t addr, uint32_t crc, BOOL save);
+#endif
+
+/**
+ * @brief 检查点占用的连续扇区数
+ * @param data_sectors 数据区扇区数
+ * @return 扇区数, 至少为1
+ * */
+uint32_t ICACHE_FLASH_ATTR ckpt_sectors(uint32_t data_sectors) {
+    uint32_t size = CKPT_HEADER_SIZE + 2 * BITMAP_WORDS(data_sectors) * sizeof(uint32_t);
+#ifdef SPIFS_USE_WEAR_LEVELING
+    size += CKPT_WEAR_BYTES(data_sectors);
+#endif
+    return ((size + SECTOR_SIZE - 1) / SECTOR_SIZE);
+}
+
+/**
+ * @brief 从检查点扇区载入FTL表与擦除次数, 头部1次读取, 各表各1次读取, 擦除次数按CKPT_WEAR_CHUNK分块读取
+ * @brief 失败时FTL表内容不确定, 调用者需清空后全区扫描
+ * @return 检查点有效且载入成功TRUE
+ * */
+BOOL ICACHE_FLASH_ATTR ckpt_load(spifs_t *fs) {
+    CkptHeader header;
+    uint32_t addr, crc, table_size;
+
+    fs->ckpt_clean = FALSE;
+    if(fs->ckpt_sector == EMPTY_INT_VALUE) {
+        return FALSE;
+    }
+    addr = (fs->ckpt_sector * SECTOR_SIZE);
+    spifs_flash_read(fs, addr, (uint32_t *)&header, sizeof(CkptHeader));
+    if((header.magic != CKPT_MAGIC) || (header.stale != EMPTY_INT_VALUE)
+            || (header.data_start != fs->data_start) || (header.data_sectors != fs->data_sectors)
+            || (header.flags != ckpt_flags())) {
+        return FALSE;
+    }
+
+    table_size = (fs->ftl_words * sizeof(uint32_t));
+    addr += CKPT_HEADER_SIZE;
+    spifs_flash_read(fs, addr, fs->ftl_erasable.map, table_size);
+    addr += table_size;
+    spifs_flash_read(fs, addr, fs->ftl_writable.map, table_size);
+    addr += table_size;
+    crc = ckpt_crc32(0, (uint8_t *)&header, 5 * sizeof(uint32_t));
+    crc = ckpt_crc32(crc, (uint8_t *)fs->ftl_erasable.map, table_size);
+    crc = ckpt_crc32(crc, (uint8_t *)fs->ftl_writable.map, table_size);
+#ifdef SPIFS_USE_WEAR_LEVELING
+    crc = ckpt_wear_io(fs, addr, crc, FALSE);
+#endif
+    if(crc != header.crc) {
+        return FALSE;
+    }
+
+    fs->ftl_erasable.count = bitmap_popcount(fs->ftl_erasable.map, fs->ftl_words);
+    fs->ftl_writable.count = bitmap_popcount(fs->ftl_writable.map, fs->ftl_words);
+#ifdef SPIFS_USE_WEAR_LEVELING
+    // 擦除次数下界, 首次选取扇区时修正
+    fs->ftl_erasable.least = 0;
+    fs->ftl_writable.least = 0;
+#endif
+    fs->ckpt_seq = header.seq;
+    fs->ckpt_clean = TRUE;
+    return TRUE;
+}
+
+/**
+ * @brief 擦除检查点扇区并写入当前FTL表, 先写表数据后写头部
+ * @return 成功TRUE, 未配置检查点扇区时FALSE
+ * */
+BOOL ICACHE_FLASH_ATTR ckpt_save(spifs_t *fs) {
+    CkptHeader header;
+    uint32_t addr, table_size, i;
+
+    if(fs->ckpt_sector == EMPTY_INT_VALUE) {
+        return FALSE;
+    }
+    os_memset(&header, 0xFF, sizeof(CkptHeader));
+    header.magic = CKPT_MAGIC;
+    header.seq = (fs->ckpt_seq + 1);
+    header.data_start = fs->data_start;
+    header.data_sectors = fs->data_sectors;
+    header.flags = ckpt_flags();
+
+    table_size = (fs->ftl_words * sizeof(uint32_t));
+    header.crc = ckpt_crc32(0, (uint8_t *)&header, 5 * sizeof(uint32_t));
+    header.crc = ckpt_crc32(header.crc, (uint8_t *)fs->ftl_erasable.map, table_size);
+    header.crc = ckpt_crc32(header.crc, (uint8_t *)fs->ftl_writable.map, table_size);
+
+    addr = (fs->ckpt_sector * SECTOR_SIZE);
+    for(i = 0; i < ckpt_sectors(fs->data_sectors); i++) {
+        spifs_flash_erase(fs, (fs->ckpt_sector + i));
+    }
+    spifs_flash_write(fs, (addr + CKPT_HEADER_SIZE), fs->ftl_erasable.map, table_size);
+    spifs_flash_write(fs, (addr + CKPT_HEADER_SIZE + table_size), fs->ftl_writable.map, table_size);
+#ifdef SPIFS_USE_WEAR_LEVELING
+    header.crc = ckpt_wear_io(fs, (addr + CKPT_HEADER_SIZE + 2 * table_size), header.crc, TRUE);
+#endif
+    // stale保持0xFFFFFFFF, 不写入
+    spifs_flash_write(fs, addr, (uint32_t *)&header, 6 * sizeof(uint32_t));
+
+    fs->ckpt_seq = header.seq;
+    fs->ckpt_clean = TRUE;
+    return TRUE;
+}
+
+/**
+ * @brief FTL即将被修改, 检查点有效时将头部stale字编程为0, 无需擦除
+ * */
+void ICACHE_FLASH_ATTR ckpt_touch(spifs_t *fs) {
+    uint32_t stale = 0;
+
+    if(!fs->ckpt_clean) {
+        return;
+    }
+    fs->ckpt_clean = FALSE;
+    spifs_flash_write(fs, (fs->ckpt_sector * SECTOR_SIZE + 7 * sizeof(uint32_t)), &stale, sizeof(uint32_t));
+}
+
+#ifdef SPIFS_USE_WEAR_LEVELING
+/**
+ * @brief 按24位打包读写擦除次数, 每次处理CKPT_WEAR_CHUNK个, 末块补0xFF至4字节对齐
+ * @param addr 擦除次数起始地址
+ * @param crc 已累计的CRC32
+ * @param save TRUE:写入fs->erase_count, FALSE:读出到fs->erase_count
+ * @return 累计擦除次数数据后的CRC32
+ * */
+static uint32_t ICACHE_FLASH_ATTR ckpt_wear_io(spifs_t *fs, uint32_t addr, uint32_t crc, BOOL save) {
+    uint32_t chunk[CKPT_WEAR_BYTES(CKPT_WEAR_CHUNK) / sizeof(uint32_t)];
+    uint8_t *bytes = (uint8_t *)chunk;
+    uint32_t i, k, n, size;
+
+    for(i = 0; i < fs->data_sectors; i += n) {
+        n = ((fs->data_sectors - i) < CKPT_WEAR_CHUNK) ? (fs->data_sectors - i) : CKPT_WEAR_CHUNK;
+        size = CKPT_WEAR_BYTES(n);
+        if(save) {
+            os_memset(chunk, 0xFF, size);
+            for(k = 0; k < n; k++) {
+                bytes[3 * k] = (uint8_t)(fs->erase_count[i + k]);
+                bytes[3 * k + 1] = (uint8_t)(fs->erase_count[i + k] >> 8);
+                bytes[3 * k + 2] = (uint8_t)(fs->erase_count[i + k] >> 16);
+            }
+            spifs_flash_write(fs, addr, chunk, size);
+        }else {
+            spifs_flash_read(fs, addr, chunk, size);
+            for(k = 0; k < n; k++) {
+                fs->erase_count[i + k] = (bytes[3 * k] | (bytes[3 * k + 1] << 8) | ((uint32_t)bytes[3 * k + 2] << 16));
+            }
+        }
+        crc = ckpt_crc32(crc, bytes, size);
+        addr += size;
+    }
+    return crc;
+}
+#endif
+
+static uint32_t ICACHE_FLASH_ATTR ckpt_flags(void) {
+#ifdef SPIFS_USE_WEAR_LEVELING
+    return (CKPT_FLAG_WEAR | CKPT_FLAG_WEAR24);
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief CRC32(多项式0xEDB88320), 半字节查表
+ * */
+static uint32_t ICACHE_FLASH_ATTR ckpt_crc32(uint32_t crc, const uint8_t *data, uint32_t length) {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+    uint32_t i;
+
+    crc = ~crc;
+    for(i = 0; i < length; i++) {
+        crc = table[(crc ^ data[i]) & 0x0F] ^ (crc >> 4);
+        crc = table[(crc ^ (data[i] >> 4)) & 0x0F] ^ (crc >> 4);
+    }
+    return ~crc;
+}
+
+#endif
@@ -0,0 +1,50 @@
+/*
+ * checkpoint.h
+ * @brief FTL检查点
+ * 检查点布局: 32字节头部 + 可擦除表 + 空白表 + 擦除次数(启用磨损均衡时, 每扇区3字节)
+ * 自检查点扇区起占用ckpt_sectors个连续扇区, 一个扇区可容纳约1300个数据区扇区
+ * 头部最后写入, 写入中断时魔数无效, 挂载回退到全区扫描
+ */
+
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include "common_def.h"
+#include "spifs.h"
+
+// 检查点魔数 "SPCK"
+#define CKPT_MAGIC          (0x4B435053)
+// 检查点头部大小(字节)
+#define CKPT_HEADER_SIZE    (32)
+// 头部标志: 包含擦除次数
+#define CKPT_FLAG_WEAR      (0x1)
+// 头部标志: 擦除次数按24位打包
+#define CKPT_FLAG_WEAR24    (0x2)
+// n个擦除次数打包后的字节数, 4字节对齐
+#define CKPT_WEAR_BYTES(n)  (((n) * 3 + 3) & ~(uint32_t)3)
+// 擦除次数分块读写数量, 栈占用CKPT_WEAR_BYTES(CKPT_WEAR_CHUNK)字节
+#define CKPT_WEAR_CHUNK     (32)
+
+/**
+ * @brief 检查点头部, stale在检查点写入后保持0xFFFFFFFF, 首次修改FTL时编程为0
+ */
+typedef struct _ckpt_header {
+    uint32_t magic;
+    uint32_t seq;              // 检查点序号, 每次写入加1
+    uint32_t data_start;       // 数据区首扇区, 与挂载配置不一致时检查点无效
+    uint32_t data_sectors;     // 数据区扇区数
+    uint32_t flags;
+    uint32_t crc;              // CRC32, 覆盖头部前5个字与全部表数据
+    uint32_t reserved;
+    uint32_t stale;
+} CkptHeader;
+
+uint32_t ICACHE_FLASH_ATTR ckpt_sectors(uint32_t data_sectors);
+
+BOOL ICACHE_FLASH_ATTR ckpt_load(spifs_t *fs);
+
+BOOL ICACHE_FLASH_ATTR ckpt_save(spifs_t *fs);
+
+void ICACHE_FLASH_ATTR ckpt_touch(spifs_t *fs);
+
+#endif
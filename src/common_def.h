@@ -9,6 +9,8 @@
 #define os_memset    memset
 #define os_strlen    strlen
 #define os_memcpy    memcpy
+#define os_memmove   memmove
+#define os_memcmp    memcmp
 #define os_malloc    malloc
 #define os_free      free
 
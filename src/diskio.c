@@ -5,9 +5,9 @@
  * @param addr 物理地址
  * @param *fb 文件结构块指针, 要求指针在4字节边界
  * */
-void ICACHE_FLASH_ATTR write_fileblock(uint32_t addr, FileBlock *fb) {
+void ICACHE_FLASH_ATTR write_fileblock(spifs_t *fs, uint32_t addr, FileBlock *fb) {
     // FileBlock已四字节对齐，可以强制指针转换
-	spi_flash_write(addr, (uint32_t *)fb, sizeof(FileBlock));
+	spifs_flash_write(fs, addr, (uint32_t *)fb, sizeof(FileBlock));
 }
 
 /**
@@ -25,8 +25,8 @@ void ICACHE_FLASH_ATTR clear_fileblock(uint8_t *baseAddr, uint32_t offset) {
  * @param secAddr 写入扇区首地址
  * @param mark 标记符
  * */
-void ICACHE_FLASH_ATTR update_sector_mark(uint32_t secAddr, uint32_t mark) {
-	spi_flash_write(secAddr, &mark, sizeof(uint32_t));
+void ICACHE_FLASH_ATTR update_sector_mark(spifs_t *fs, uint32_t secAddr, uint32_t mark) {
+	spifs_flash_write(fs, secAddr, &mark, sizeof(uint32_t));
 }
 
 /**
@@ -34,8 +34,8 @@ void ICACHE_FLASH_ATTR update_sector_mark(uint32_t secAddr, uint32_t mark) {
  * @param fbaddr 文件块地址
  * @param cluster 首簇地址
  * */
-void ICACHE_FLASH_ATTR write_fileblock_cluster(uint32_t fbaddr, uint32_t cluster) {
-	spi_flash_write(fbaddr + 12, &cluster, sizeof(uint32_t));
+void ICACHE_FLASH_ATTR write_fileblock_cluster(spifs_t *fs, uint32_t fbaddr, uint32_t cluster) {
+	spifs_flash_write(fs, fbaddr + 12, &cluster, sizeof(uint32_t));
 }
 
 /**
@@ -43,8 +43,21 @@ void ICACHE_FLASH_ATTR write_fileblock_cluster(uint32_t fbaddr, uint32_t cluster
  * @param fbaddr 文件块地址
  * @param length 文件长度
  * */
-void ICACHE_FLASH_ATTR write_fileblock_length(uint32_t fbaddr, uint32_t length) {
-	spi_flash_write(fbaddr + 16, &length, sizeof(uint32_t));
+void ICACHE_FLASH_ATTR write_fileblock_length(spifs_t *fs, uint32_t fbaddr, uint32_t length) {
+	spifs_flash_write(fs, fbaddr + 16, &length, sizeof(uint32_t));
+}
+
+/**
+ * 写文件块首簇地址与文件长度, 两字段相邻, 一次写入
+ * @param fbaddr 文件块地址
+ * @param cluster 首簇地址
+ * @param length 文件长度
+ * */
+void ICACHE_FLASH_ATTR write_fileblock_extent(spifs_t *fs, uint32_t fbaddr, uint32_t cluster, uint32_t length) {
+	uint32_t extent[2];
+	extent[0] = cluster;
+	extent[1] = length;
+	spifs_flash_write(fs, fbaddr + 12, extent, sizeof(extent));
 }
 
 /**
@@ -52,13 +65,81 @@ void ICACHE_FLASH_ATTR write_fileblock_length(uint32_t fbaddr, uint32_t length)
  * @param fbaddr 文件块地址
  * @param state 文件状态字段
  * */
-void ICACHE_FLASH_ATTR write_fileblock_state(uint32_t fbaddr, uint8_t fstate) {
+void ICACHE_FLASH_ATTR write_fileblock_state(spifs_t *fs, uint32_t fbaddr, uint8_t fstate) {
     FileInfo finfo;
     FileStatePack fspack;
-    spi_flash_read(fbaddr + 20, (uint32_t *)&finfo, sizeof(uint32_t));
+    spifs_flash_read(fs, fbaddr + 20, (uint32_t *)&finfo, sizeof(uint32_t));
     fspack.fstate = finfo.state;
     // 由于flash仅能由1->0因此这里使用&操作
     fspack.data &= fstate;
     finfo.state = fspack.fstate;
-    spi_flash_write(fbaddr + 20, (uint32_t *)&finfo, sizeof(uint32_t));
+    spifs_flash_write(fs, fbaddr + 20, (uint32_t *)&finfo, sizeof(uint32_t));
+}
+
+#ifdef SPIFS_USE_STATS
+SpiFlashOpResult ICACHE_FLASH_ATTR spifs_ops_read(spifs_t *fs, uint32_t addr, uint32_t *buffer, uint32_t size) {
+    fs->stats[fs->stats_api].reads++;
+    fs->stats[fs->stats_api].read_bytes += size;
+    return fs->ops->read(fs->flash, addr, buffer, size);
+}
+
+SpiFlashOpResult ICACHE_FLASH_ATTR spifs_ops_write(spifs_t *fs, uint32_t addr, uint32_t *buffer, uint32_t size) {
+    fs->stats[fs->stats_api].writes++;
+    fs->stats[fs->stats_api].write_bytes += size;
+    return fs->ops->write(fs->flash, addr, buffer, size);
+}
+
+SpiFlashOpResult ICACHE_FLASH_ATTR spifs_ops_erase(spifs_t *fs, uint32_t sec) {
+    fs->stats[fs->stats_api].erases++;
+    return fs->ops->erase(fs->flash, sec);
+}
+
+SpiFlashOpResult ICACHE_FLASH_ATTR spifs_ops_erase_start(spifs_t *fs, uint32_t sec) {
+    fs->stats[fs->stats_api].erases++;
+    return fs->ops->erase_start(fs->flash, sec);
+}
+
+/**
+ * 块擦除, 驱动拒绝(未对齐等)时不计数
+ * */
+SpiFlashOpResult ICACHE_FLASH_ATTR spifs_ops_erase_block(spifs_t *fs, uint32_t sec, uint32_t secs) {
+    SpiFlashOpResult ret = fs->ops->erase_block(fs->flash, sec, secs);
+    if(ret == SPI_FLASH_RESULT_OK) {
+        fs->stats[fs->stats_api].block_erases++;
+    }
+    return ret;
+}
+#endif
+
+static SpiFlashOpResult ICACHE_FLASH_ATTR spi_flash_ops_read(void *flash, uint32_t addr, uint32_t *buffer, uint32_t size) {
+    return spi_flash_read(addr, buffer, size);
+}
+
+static SpiFlashOpResult ICACHE_FLASH_ATTR spi_flash_ops_write(void *flash, uint32_t addr, uint32_t *buffer, uint32_t size) {
+    return spi_flash_write(addr, buffer, size);
+}
+
+static SpiFlashOpResult ICACHE_FLASH_ATTR spi_flash_ops_erase(void *flash, uint32_t sec) {
+    return spi_flash_erase_sector((uint16_t)sec);
+}
+
+static SpiFlashOpResult ICACHE_FLASH_ATTR spi_flash_ops_erase_start(void *flash, uint32_t sec) {
+    return spi_flash_erase_sector_start((uint16_t)sec);
+}
+
+static uint8_t ICACHE_FLASH_ATTR spi_flash_ops_busy(void *flash) {
+    return spi_flash_busy();
+}
+
+static SpiFlashOpResult ICACHE_FLASH_ATTR spi_flash_ops_erase_block(void *flash, uint32_t sec, uint32_t secs) {
+    return spi_flash_erase_block((uint16_t)sec, (uint16_t)secs);
 }
+
+const SpifsFlashOps SPIFS_SPI_FLASH_OPS = {
+    spi_flash_ops_read,
+    spi_flash_ops_write,
+    spi_flash_ops_erase,
+    spi_flash_ops_erase_start,
+    spi_flash_ops_busy,
+    spi_flash_ops_erase_block
+};
@@ -5,12 +5,44 @@
 #include "spi_flash.h"
 #include "spifs.h"
 
-void ICACHE_FLASH_ATTR write_fileblock(uint32_t addr, FileBlock *fb);
+// 调用文件系统实例的flash操作接口, 启用统计时计入当前API
+#ifdef SPIFS_USE_STATS
+SpiFlashOpResult ICACHE_FLASH_ATTR spifs_ops_read(spifs_t *fs, uint32_t addr, uint32_t *buffer, uint32_t size);
+SpiFlashOpResult ICACHE_FLASH_ATTR spifs_ops_write(spifs_t *fs, uint32_t addr, uint32_t *buffer, uint32_t size);
+SpiFlashOpResult ICACHE_FLASH_ATTR spifs_ops_erase(spifs_t *fs, uint32_t sec);
+SpiFlashOpResult ICACHE_FLASH_ATTR spifs_ops_erase_start(spifs_t *fs, uint32_t sec);
+SpiFlashOpResult ICACHE_FLASH_ATTR spifs_ops_erase_block(spifs_t *fs, uint32_t sec, uint32_t secs);
+#else
+#define spifs_ops_read(fs, addr, buffer, size)       ((fs)->ops->read((fs)->flash, (addr), (buffer), (size)))
+#define spifs_ops_write(fs, addr, buffer, size)      ((fs)->ops->write((fs)->flash, (addr), (buffer), (size)))
+#define spifs_ops_erase(fs, sec)                     ((fs)->ops->erase((fs)->flash, (sec)))
+#define spifs_ops_erase_start(fs, sec)               ((fs)->ops->erase_start((fs)->flash, (sec)))
+#define spifs_ops_erase_block(fs, sec, secs)         ((fs)->ops->erase_block((fs)->flash, (sec), (secs)))
+#endif
+
+// 通过文件系统实例的flash操作接口访问flash
+#ifdef SPIFS_USE_CACHE
+#include "cache.h"
+// 经读缓存访问, 见cache.c
+#define spifs_flash_read(fs, addr, buffer, size)     cache_read((fs), (addr), (buffer), (size))
+#define spifs_flash_write(fs, addr, buffer, size)    cache_write((fs), (addr), (buffer), (size))
+#define spifs_flash_erase(fs, sec)                   cache_erase((fs), (sec))
+#else
+#define spifs_flash_read(fs, addr, buffer, size)     spifs_ops_read((fs), (addr), (buffer), (size))
+#define spifs_flash_write(fs, addr, buffer, size)    spifs_ops_write((fs), (addr), (buffer), (size))
+#define spifs_flash_erase(fs, sec)                   spifs_ops_erase((fs), (sec))
+#endif
+
+// 默认flash操作接口, 转发到spi_flash_*, flash参数未使用
+extern const SpifsFlashOps SPIFS_SPI_FLASH_OPS;
+
+void ICACHE_FLASH_ATTR write_fileblock(spifs_t *fs, uint32_t addr, FileBlock *fb);
 void ICACHE_FLASH_ATTR clear_fileblock(uint8_t *baseAddr, uint32_t offset);
-void ICACHE_FLASH_ATTR update_sector_mark(uint32_t secAddr, uint32_t mark);
+void ICACHE_FLASH_ATTR update_sector_mark(spifs_t *fs, uint32_t secAddr, uint32_t mark);
 
-void ICACHE_FLASH_ATTR write_fileblock_cluster(uint32_t fbaddr, uint32_t cluster);
-void ICACHE_FLASH_ATTR write_fileblock_length(uint32_t fbaddr, uint32_t length);
-void ICACHE_FLASH_ATTR write_fileblock_state(uint32_t fbaddr, uint8_t fstate);
+void ICACHE_FLASH_ATTR write_fileblock_cluster(spifs_t *fs, uint32_t fbaddr, uint32_t cluster);
+void ICACHE_FLASH_ATTR write_fileblock_length(spifs_t *fs, uint32_t fbaddr, uint32_t length);
+void ICACHE_FLASH_ATTR write_fileblock_extent(spifs_t *fs, uint32_t fbaddr, uint32_t cluster, uint32_t length);
+void ICACHE_FLASH_ATTR write_fileblock_state(spifs_t *fs, uint32_t fbaddr, uint8_t fstate);
 
 #endif
@@ -0,0 +1,338 @@
+#include "fbindex.h"
+#include "bitmap.h"
+
+#ifdef SPIFS_USE_FB_SLOTMAP
+#define FB_SLOTMAP_WORDS(fs)    (((fs)->fb_slots + BITS_OF_INTEGER - 1) / BITS_OF_INTEGER)
+#define FB_SECTOR_COUNT(fs)     ((fs)->fb_end - (fs)->fb_start + 1)
+#endif
+
+/**
+ * @brief 按文件索引区大小分配哈希索引与槽位状态表, 分配后均为失效状态
+ * @return 成功TRUE, 内存不足FALSE(已分配部分由fb_tables_free释放)
+ * */
+BOOL ICACHE_FLASH_ATTR fb_tables_alloc(spifs_t *fs) {
+#ifdef SPIFS_USE_FB_INDEX
+    // hash_head: 哈希桶链表头, 存放文件块槽位编号, FB_HASH_NULL表示空桶
+    // hash_next: 槽位链表后继, 与hash_head组成拉链法哈希表
+    // hash_tag: 槽位文件名哈希值高8位, 用于减少校验时的flash读取
+    fs->hash_head = (uint16_t *)os_malloc(FB_HASH_BUCKETS * sizeof(uint16_t));
+    fs->hash_next = (uint16_t *)os_malloc(fs->fb_slots * sizeof(uint16_t));
+    fs->hash_tag = (uint8_t *)os_malloc(fs->fb_slots);
+    // 索引是否与flash文件索引区一致, 未建立时调用者需回退到全区扫描
+    fs->index_valid = FALSE;
+    if(fs->hash_head == NULL || fs->hash_next == NULL || fs->hash_tag == NULL) {
+        return FALSE;
+    }
+#endif
+#ifdef SPIFS_USE_FB_SLOTMAP
+    // slot_used: 1:槽位已写入文件名(有效或废弃), 0:空闲, 超出fb_slots的尾部位固定为1, 不会被分配
+    // slot_live: 1:有效文件块, 0:空闲或废弃
+    // slot_dead: 各文件索引扇区废弃槽位计数
+    fs->slot_used = (uint32_t *)os_malloc(FB_SLOTMAP_WORDS(fs) * sizeof(uint32_t));
+    fs->slot_live = (uint32_t *)os_malloc(FB_SLOTMAP_WORDS(fs) * sizeof(uint32_t));
+    fs->slot_dead = (uint16_t *)os_malloc(FB_SECTOR_COUNT(fs) * sizeof(uint16_t));
+    fs->free_slots = 0;
+    fs->slots_valid = FALSE;
+    if(fs->slot_used == NULL || fs->slot_live == NULL || fs->slot_dead == NULL) {
+        return FALSE;
+    }
+#endif
+    return TRUE;
+}
+
+void ICACHE_FLASH_ATTR fb_tables_free(spifs_t *fs) {
+#ifdef SPIFS_USE_FB_INDEX
+    os_free(fs->hash_head);
+    os_free(fs->hash_next);
+    os_free(fs->hash_tag);
+    fs->hash_head = NULL;
+    fs->hash_next = NULL;
+    fs->hash_tag = NULL;
+    fs->index_valid = FALSE;
+#endif
+#ifdef SPIFS_USE_FB_SLOTMAP
+    os_free(fs->slot_used);
+    os_free(fs->slot_live);
+    os_free(fs->slot_dead);
+    fs->slot_used = NULL;
+    fs->slot_live = NULL;
+    fs->slot_dead = NULL;
+    fs->slots_valid = FALSE;
+#endif
+}
+
+#ifdef SPIFS_USE_FB_INDEX
+
+static uint32_t ICACHE_FLASH_ATTR fb_name_hash(uint8_t *rawname);
+
+static BOOL ICACHE_FLASH_ATTR fb_name_equals(uint8_t *src, uint8_t *target);
+
+/**
+ * @brief 清空哈希索引并标记为可用, 格式化或挂载扫描前调用
+ * */
+void ICACHE_FLASH_ATTR fb_index_reset(spifs_t *fs) {
+    os_memset(fs->hash_head, 0xFF, FB_HASH_BUCKETS * sizeof(uint16_t));
+    os_memset(fs->hash_next, 0xFF, fs->fb_slots * sizeof(uint16_t));
+    os_memset(fs->hash_tag, 0x00, fs->fb_slots);
+    fs->index_valid = TRUE;
+}
+
+/**
+ * @brief 标记哈希索引失效, 之后的查找回退到全区扫描, 直到下次spifs_ftl_init
+ * */
+void ICACHE_FLASH_ATTR fb_index_invalidate(spifs_t *fs) {
+    fs->index_valid = FALSE;
+}
+
+BOOL ICACHE_FLASH_ATTR fb_index_ready(spifs_t *fs) {
+    return fs->index_valid;
+}
+
+/**
+ * @brief 添加文件块到哈希索引, 仅索引未被标记删除/失效的文件块
+ * @param fbaddr 文件块物理地址
+ * @param rawname 原始文件名(文件名8字节+拓展名4字节, 空缺部分0xFF)
+ * */
+void ICACHE_FLASH_ATTR fb_index_insert(spifs_t *fs, uint32_t fbaddr, uint8_t *rawname) {
+    uint32_t hash, bucket, slot;
+
+    if(!fs->index_valid) return;
+
+    slot = fb_slot_index(fs, fbaddr);
+    hash = fb_name_hash(rawname);
+    bucket = (hash & (FB_HASH_BUCKETS - 1));
+
+    fs->hash_tag[slot] = (uint8_t)(hash >> 24);
+    fs->hash_next[slot] = fs->hash_head[bucket];
+    fs->hash_head[bucket] = (uint16_t)slot;
+}
+
+/**
+ * @brief 从哈希索引移除文件块, 文件块不在索引中时无操作
+ * @param fbaddr 文件块物理地址
+ * @param rawname 文件块记录的原始文件名
+ * */
+void ICACHE_FLASH_ATTR fb_index_remove(spifs_t *fs, uint32_t fbaddr, uint8_t *rawname) {
+    uint32_t bucket, slot;
+    uint16_t *link;
+
+    if(!fs->index_valid) return;
+
+    slot = fb_slot_index(fs, fbaddr);
+    bucket = (fb_name_hash(rawname) & (FB_HASH_BUCKETS - 1));
+
+    for(link = &fs->hash_head[bucket]; *link != FB_HASH_NULL; link = &fs->hash_next[*link]) {
+        if(*link == slot) {
+            *link = fs->hash_next[slot];
+            fs->hash_next[slot] = FB_HASH_NULL;
+            return;
+        }
+    }
+}
+
+/**
+ * @brief 移除位于指定文件索引扇区的全部文件块, 用于整扇区擦除
+ * @param sec 扇区编号 fb_start~fb_end
+ * */
+void ICACHE_FLASH_ATTR fb_index_drop_sector(spifs_t *fs, uint32_t sec) {
+    uint32_t bucket, first, last;
+    uint16_t *link;
+
+    if(!fs->index_valid) return;
+
+    first = (sec - fs->fb_start) * FB_SLOTS_PER_SECTOR;
+    last = (first + FB_SLOTS_PER_SECTOR);
+
+    for(bucket = 0; bucket < FB_HASH_BUCKETS; bucket++) {
+        link = &fs->hash_head[bucket];
+        while(*link != FB_HASH_NULL) {
+            if((*link >= first) && (*link < last)) {
+                *link = fs->hash_next[*link];
+            }else {
+                link = &fs->hash_next[*link];
+            }
+        }
+    }
+}
+
+/**
+ * @brief 根据原始文件名查找有效文件块, 命中后读取flash校验文件名与状态
+ * @param rawname 原始文件名(12字节)
+ * @param *fb 存放查找到的文件块, 要求4字节对齐
+ * @return 文件块物理地址, 未找到返回EMPTY_INT_VALUE
+ * */
+uint32_t ICACHE_FLASH_ATTR fb_index_lookup(spifs_t *fs, uint8_t *rawname, FileBlock *fb) {
+    uint32_t hash, fbaddr;
+    uint16_t slot;
+    uint8_t tag;
+
+    hash = fb_name_hash(rawname);
+    tag = (uint8_t)(hash >> 24);
+
+    for(slot = fs->hash_head[hash & (FB_HASH_BUCKETS - 1)]; slot != FB_HASH_NULL; slot = fs->hash_next[slot]) {
+        if(fs->hash_tag[slot] != tag) {
+            continue;
+        }
+        fbaddr = fb_slot_addr(fs, slot);
+        spifs_flash_read(fs, fbaddr, (uint32_t *)fb, sizeof(FileBlock));
+        if((fb->info.state.del & fb->info.state.dep) && fb_name_equals(fb->filename, rawname)) {
+            return fbaddr;
+        }
+    }
+    return EMPTY_INT_VALUE;
+}
+
+/**
+ * @brief FNV-1a 32位哈希
+ * */
+static uint32_t ICACHE_FLASH_ATTR fb_name_hash(uint8_t *rawname) {
+    uint32_t i, hash = 0x811C9DC5;
+    for(i = 0; i < FILENAME_FULLSIZE; i++) {
+        hash ^= rawname[i];
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+
+static BOOL ICACHE_FLASH_ATTR fb_name_equals(uint8_t *src, uint8_t *target) {
+    uint32_t i;
+    for(i = 0; i < FILENAME_FULLSIZE; i++) {
+        if(src[i] != target[i]) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+#endif
+
+#ifdef SPIFS_USE_FB_SLOTMAP
+
+/**
+ * @brief 所有槽位置为空闲并标记槽位状态表可用
+ * */
+void ICACHE_FLASH_ATTR fb_slots_reset(spifs_t *fs) {
+    os_memset(fs->slot_used, 0x00, FB_SLOTMAP_WORDS(fs) * sizeof(uint32_t));
+    os_memset(fs->slot_live, 0x00, FB_SLOTMAP_WORDS(fs) * sizeof(uint32_t));
+    os_memset(fs->slot_dead, 0x00, FB_SECTOR_COUNT(fs) * sizeof(uint16_t));
+    // 尾部无效槽位置为已占用
+    bitmap_fill(fs->slot_used, fs->fb_slots, (FB_SLOTMAP_WORDS(fs) * BITS_OF_INTEGER - fs->fb_slots), 1);
+    fs->free_slots = fs->fb_slots;
+    fs->slots_valid = TRUE;
+}
+
+/**
+ * @brief 标记槽位状态表失效, 之后的空闲槽位查找回退到扫描flash
+ * */
+void ICACHE_FLASH_ATTR fb_slots_invalidate(spifs_t *fs) {
+    fs->slots_valid = FALSE;
+}
+
+BOOL ICACHE_FLASH_ATTR fb_slots_ready(spifs_t *fs) {
+    return fs->slots_valid;
+}
+
+/**
+ * @brief 设置槽位状态, 同步空闲计数与扇区废弃计数
+ * @param slot 槽位编号
+ * @param state FB_SLOT_FREE/FB_SLOT_LIVE/FB_SLOT_DEAD
+ * */
+void ICACHE_FLASH_ATTR fb_slots_set(spifs_t *fs, uint32_t slot, uint32_t state) {
+    uint32_t index, mask, sec, prev;
+
+    if(!fs->slots_valid) return;
+
+    prev = fb_slots_get(fs, slot);
+    if(prev == state) return;
+
+    index = (slot / BITS_OF_INTEGER);
+    mask = ((uint32_t)0x1 << (slot - index * BITS_OF_INTEGER));
+    sec = (slot / FB_SLOTS_PER_SECTOR);
+
+    if(prev == FB_SLOT_FREE) {
+        fs->free_slots--;
+    }else if(prev == FB_SLOT_DEAD) {
+        fs->slot_dead[sec]--;
+    }
+
+    if(state == FB_SLOT_FREE) {
+        fs->slot_used[index] &= ~mask;
+        fs->slot_live[index] &= ~mask;
+        fs->free_slots++;
+    }else if(state == FB_SLOT_LIVE) {
+        fs->slot_used[index] |= mask;
+        fs->slot_live[index] |= mask;
+    }else {
+        fs->slot_used[index] |= mask;
+        fs->slot_live[index] &= ~mask;
+        fs->slot_dead[sec]++;
+    }
+}
+
+/**
+ * @param slot 槽位编号
+ * @return FB_SLOT_FREE/FB_SLOT_LIVE/FB_SLOT_DEAD
+ * */
+uint32_t ICACHE_FLASH_ATTR fb_slots_get(spifs_t *fs, uint32_t slot) {
+    uint32_t index, offset;
+
+    index = (slot / BITS_OF_INTEGER);
+    offset = (slot - index * BITS_OF_INTEGER);
+
+    if(!((fs->slot_used[index] >> offset) & 0x1)) {
+        return FB_SLOT_FREE;
+    }
+    return ((fs->slot_live[index] >> offset) & 0x1) ? FB_SLOT_LIVE : FB_SLOT_DEAD;
+}
+
+/**
+ * @brief 按字扫描查找编号最小的空闲槽位
+ * @return 槽位编号, 无空闲槽位返回EMPTY_INT_VALUE
+ * */
+uint32_t ICACHE_FLASH_ATTR fb_slots_find_free(spifs_t *fs) {
+    uint32_t index;
+
+    if(fs->free_slots == 0) {
+        return EMPTY_INT_VALUE;
+    }
+    for(index = 0; index < FB_SLOTMAP_WORDS(fs); index++) {
+        if(fs->slot_used[index] != EMPTY_INT_VALUE) {
+            return (index * BITS_OF_INTEGER + bitmap_ctz(~fs->slot_used[index]));
+        }
+    }
+    return EMPTY_INT_VALUE;
+}
+
+uint32_t ICACHE_FLASH_ATTR fb_slots_free_count(spifs_t *fs) {
+    return fs->free_slots;
+}
+
+/**
+ * @param sec 扇区编号 fb_start~fb_end
+ * @return 该扇区废弃槽位数量
+ * */
+uint32_t ICACHE_FLASH_ATTR fb_slots_dead_count(spifs_t *fs, uint32_t sec) {
+    return fs->slot_dead[sec - fs->fb_start];
+}
+
+#endif
+
+/**
+ * @brief 文件块物理地址转换为槽位编号
+ * @param fbaddr 文件块物理地址
+ * @return 槽位编号 0~(fs->fb_slots-1)
+ * */
+uint32_t ICACHE_FLASH_ATTR fb_slot_index(spifs_t *fs, uint32_t fbaddr) {
+    uint32_t sec = (fbaddr / SECTOR_SIZE);
+    return ((sec - fs->fb_start) * FB_SLOTS_PER_SECTOR + (fbaddr - sec * SECTOR_SIZE) / FILEBLOCK_SIZE);
+}
+
+/**
+ * @brief 槽位编号转换为文件块物理地址
+ * @param slot 槽位编号
+ * @return 文件块物理地址
+ * */
+uint32_t ICACHE_FLASH_ATTR fb_slot_addr(spifs_t *fs, uint32_t slot) {
+    uint32_t sec = (slot / FB_SLOTS_PER_SECTOR);
+    return ((fs->fb_start + sec) * SECTOR_SIZE + (slot - sec * FB_SLOTS_PER_SECTOR) * FILEBLOCK_SIZE);
+}
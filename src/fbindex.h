@@ -0,0 +1,70 @@
+/*
+ * fbindex.h
+ * @brief 文件索引区RAM索引
+ * 哈希索引: 以12字节原始文件名(文件名+拓展名)为键
+ * 槽位状态表: 记录每个文件块槽位的空闲/有效/废弃状态
+ */
+
+#ifndef _FBINDEX_H_
+#define _FBINDEX_H_
+
+#include "common_def.h"
+#include "spifs.h"
+
+// 单个文件索引扇区可容纳的文件块数量
+#define FB_SLOTS_PER_SECTOR    (SECTOR_SIZE / FILEBLOCK_SIZE)
+// 文件索引区文件块总数量上限, 槽位编号为16位且FB_HASH_NULL保留
+#define FB_SLOT_MAX            (0xFFFF)
+
+// 哈希桶数量, 必须为2的幂
+#define FB_HASH_BUCKETS        (256)
+// 哈希链表结束标记
+#define FB_HASH_NULL           (0xFFFF)
+
+// 文件块槽位状态
+// 空闲: 未写入文件名, 可直接写入新文件块
+#define FB_SLOT_FREE           (0)
+// 有效: 未被标记删除/失效的文件块
+#define FB_SLOT_LIVE           (1)
+// 废弃: 被标记删除/失效, 等待GC回收
+#define FB_SLOT_DEAD           (2)
+
+BOOL ICACHE_FLASH_ATTR fb_tables_alloc(spifs_t *fs);
+
+void ICACHE_FLASH_ATTR fb_tables_free(spifs_t *fs);
+
+void ICACHE_FLASH_ATTR fb_index_reset(spifs_t *fs);
+
+void ICACHE_FLASH_ATTR fb_index_invalidate(spifs_t *fs);
+
+BOOL ICACHE_FLASH_ATTR fb_index_ready(spifs_t *fs);
+
+void ICACHE_FLASH_ATTR fb_index_insert(spifs_t *fs, uint32_t fbaddr, uint8_t *rawname);
+
+void ICACHE_FLASH_ATTR fb_index_remove(spifs_t *fs, uint32_t fbaddr, uint8_t *rawname);
+
+void ICACHE_FLASH_ATTR fb_index_drop_sector(spifs_t *fs, uint32_t sec);
+
+uint32_t ICACHE_FLASH_ATTR fb_index_lookup(spifs_t *fs, uint8_t *rawname, FileBlock *fb);
+
+void ICACHE_FLASH_ATTR fb_slots_reset(spifs_t *fs);
+
+void ICACHE_FLASH_ATTR fb_slots_invalidate(spifs_t *fs);
+
+BOOL ICACHE_FLASH_ATTR fb_slots_ready(spifs_t *fs);
+
+void ICACHE_FLASH_ATTR fb_slots_set(spifs_t *fs, uint32_t slot, uint32_t state);
+
+uint32_t ICACHE_FLASH_ATTR fb_slots_get(spifs_t *fs, uint32_t slot);
+
+uint32_t ICACHE_FLASH_ATTR fb_slots_find_free(spifs_t *fs);
+
+uint32_t ICACHE_FLASH_ATTR fb_slots_free_count(spifs_t *fs);
+
+uint32_t ICACHE_FLASH_ATTR fb_slots_dead_count(spifs_t *fs, uint32_t sec);
+
+uint32_t ICACHE_FLASH_ATTR fb_slot_index(spifs_t *fs, uint32_t fbaddr);
+
+uint32_t ICACHE_FLASH_ATTR fb_slot_addr(spifs_t *fs, uint32_t slot);
+
+#endif
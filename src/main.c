@@ -15,6 +15,8 @@ static void read_test();
 static void rename_test();
 static void append_exist_file_test();
 
+static spifs_t fs;
+
 int main(int argc, char **argv) {
 
     w25q32_allocate();
@@ -23,7 +25,13 @@ int main(int argc, char **argv) {
     uint16_t spifs_version = spifs_get_version();
     printf("spifs version:%d.%d\n", (spifs_version >> 8 & 0xFF), (spifs_version & 0xFF));
 
-    spifs_format();
+    SpifsConfig cfg;
+    spifs_default_config(&cfg);
+#ifdef SPIFS_USE_MMAP
+    cfg.mmap_base = w25q32_getbuffer();
+#endif
+    spifs_init(&fs, &cfg);
+    spifs_format(&fs);
     printf("spifs format\n");
 
     printf("platform:%I64dbit\n", (sizeof(size_t) * 8));
@@ -51,16 +59,16 @@ int main(int argc, char **argv) {
     uint32_t next = 0, find = 0;
 
     // ļг
-    find = list_file(&next, filse, 8);
+    find = list_file(&fs, &next, filse, 8);
     printf("list_file: %d\n", find);
 
     disp_list(filse, find);
 
     // ʣռ
-    uint32_t availFiles = spifs_avail_files();
+    uint32_t availFiles = spifs_avail_files(&fs);
     printf("> spifs_avail_files:%d\n", availFiles);
 
-    uint32_t availSector= spifs_avail_sector();
+    uint32_t availSector= spifs_avail_sector(&fs);
     printf("> spifs_avail_sectors:%d\n", availSector);
 
     #ifdef LOCALIZATION
@@ -70,6 +78,7 @@ int main(int argc, char **argv) {
         }
     #endif // LOCALIZATION
 
+    spifs_unmount(&fs);
     w25q32_destory();
     puts("w25q32 destory");
 
@@ -104,7 +113,7 @@ static void load_into(char *fullname, char *filename, char *extname) {
     // create new file
     make_finfo(&finfo, year, month, day, fstate);
     make_file(&file, filename, extname);
-    result = create_file(&file, &finfo);
+    result = create_file(&fs, &file, &finfo);
     printf("create %s.%s result:%d\n", filename, extname, result);
 
     if(result != CREATE_FILE_SUCCESS) {
@@ -115,12 +124,12 @@ static void load_into(char *fullname, char *filename, char *extname) {
     while(fsize > 0) {
         loadsize = (fsize > limit) ? limit : fsize;
         fread(buffer, 1, loadsize, raw);
-        result = write_file(&file, buffer, loadsize, APPEND);
+        result = write_file(&fs, &file, buffer, loadsize, APPEND);
         printf("part:%d, write_file result:%d\n", part, result);
         fsize -= loadsize;
         part++;
     }
-    result = write_finish(&file);
+    result = write_finish(&fs, &file);
     printf("write_finish result:%d\n", result);
 
     fclose(raw);
@@ -138,7 +147,7 @@ static void test_create() {
     make_finfo(&finfo, 2020, 9, 2, (FSTATE_DEFAULT));
     make_file(&file, "tiimage", "c");
 
-    result = create_file(&file, &finfo);
+    result = create_file(&fs, &file, &finfo);
 
     printf("test_create: ");
 
@@ -149,7 +158,7 @@ static void test_create() {
         printf("address and length aligned write test: ");
         // ׷д
         memset(buffer, 0xAA, sizeof(uint8_t) * 16);
-        result = write_file(&file, buffer, 12, APPEND);
+        result = write_file(&fs, &file, buffer, 12, APPEND);
         if(result == APPEND_FILE_SUCCESS) {
             puts("> APPEND_FILE_SUCCESS");
         }else {
@@ -159,7 +168,7 @@ static void test_create() {
         printf("length not aligned write test: ");
         // Ƕ׷д
         memset(buffer, 0xBB, sizeof(uint8_t) * 12);
-        result = write_file(&file, buffer, 3, APPEND);
+        result = write_file(&fs, &file, buffer, 3, APPEND);
         if(result == APPEND_FILE_SUCCESS) {
             puts("> APPEND_FILE_SUCCESS");
         }else {
@@ -169,7 +178,7 @@ static void test_create() {
         printf("address not aligned write test: ");
         // ׷д
         memset(buffer, 0xCC, sizeof(uint8_t) * 16);
-        result = write_file(&file, (buffer + 1), 8, APPEND);
+        result = write_file(&fs, &file, (buffer + 1), 8, APPEND);
         if(result == APPEND_FILE_SUCCESS) {
             puts("> APPEND_FILE_SUCCESS");
         }else {
@@ -179,21 +188,21 @@ static void test_create() {
         printf("address & length not aligned write test: ");
         // ׷д
         memset(buffer, 0xDD, sizeof(uint8_t) * 16);
-        result = write_file(&file, buffer + 2, 5, APPEND);
+        result = write_file(&fs, &file, buffer + 2, 5, APPEND);
         if(result == APPEND_FILE_SUCCESS) {
             puts("> APPEND_FILE_SUCCESS");
         }else {
             printf("> write_file err:%d\n", result);
         }
 
-        write_finish(&file);
+        write_finish(&fs, &file);
 
         // д
         printf("override write test: ");
         for(uint32_t i = 0; i < 12; i++) {
             *(buffer + i) = i;
         }
-        result = write_file(&file, buffer, 12, OVERRIDE);
+        result = write_file(&fs, &file, buffer, 12, OVERRIDE);
         if(result == WRITE_FILE_SUCCESS) {
             puts("> WRITE_FILE_SUCCESS");
         }else {
@@ -213,11 +222,11 @@ static void append_exist_file_test() {
 
     printf("append_exist_file_test\n");
 
-    if(open_file(&file, "tiimage", "c")) {
+    if(open_file(&fs, &file, "tiimage", "c")) {
         printf("open file success!\n");
 
         printf("append file: ");
-        result = write_file(&file, buffer, 13, APPEND);
+        result = write_file(&fs, &file, buffer, 13, APPEND);
         if(result == APPEND_FILE_SUCCESS) {
             printf("> APPEND_FILE_SUCCESS\n");
         }else {
@@ -225,7 +234,7 @@ static void append_exist_file_test() {
         }
 
         printf("write finish: ");
-        result = write_finish(&file);
+        result = write_finish(&fs, &file);
         if(result == APPEND_FILE_FINISH) {
             printf("> APPEND_FILE_FINISH\n");
         }else {
@@ -244,7 +253,7 @@ static void read_test() {
     // ļ
     puts("read_test");
 
-    if(open_file(&file, "tiimage", "c")) {
+    if(open_file(&fs, &file, "tiimage", "c")) {
 
         printf("open_file success\n");
 
@@ -252,7 +261,7 @@ static void read_test() {
 
         // ƫ/ȶ
         printf("offset and length aligned read: ");
-        result = read_file(&file, 0, buffer, 8);
+        result = read_file(&fs, &file, 0, buffer, 8);
         printf("> actually read in:%d bytes\n", result);
         for(uint32_t i = 0; i < 8; i++) {
             printf("0x%x ", buffer[i]);
@@ -262,7 +271,7 @@ static void read_test() {
         // ƫƲ룬ȶ
         printf("offset not aligned read: ");
         memset(buffer, 0x00, 16);
-        result = read_file(&file, 3, buffer, 8);
+        result = read_file(&fs, &file, 3, buffer, 8);
         printf("> actually read in:%d bytes\n", result);
         for(uint32_t i = 0; i < 8; i++) {
             printf("0x%x ", buffer[i]);
@@ -272,7 +281,7 @@ static void read_test() {
 
         printf("offset and length not aligned read: ");
         memset(buffer, 0x00, 16);
-        result = read_file(&file, 3, buffer, 7);
+        result = read_file(&fs, &file, 3, buffer, 7);
         printf("> actually read in:%d bytes\n", result);
         for(uint32_t i = 0; i < 7; i++) {
             printf("0x%x ", buffer[i]);
@@ -288,8 +297,8 @@ static void read_test() {
 static void rename_test() {
     File file;
     Result res;
-    if(open_file(&file, "tiimage", "c")) {
-        res = rename_file(&file, "hello", "java");
+    if(open_file(&fs, &file, "tiimage", "c")) {
+        res = rename_file(&fs, &file, "hello", "java");
         printf("rename file result:%d\n", res);
     }
 }
@@ -315,7 +324,7 @@ void disp_list(File *files, uint32_t total) {
     for(int i = 0; i < total; i++) {
         printf("filename:"); display_fname((files + i)); putchar('\n');
 
-        read_finfo((files + i), &finfo);
+        read_finfo(&fs, (files + i), &finfo);
         printf("create_time: %d-%d-%d\n", (finfo.year+2000), finfo.month, finfo.day);
         fspack.fstate = finfo.state;
         printf("file_state: 0x%x\n", fspack.data);
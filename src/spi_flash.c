@@ -4,17 +4,49 @@ uint32_t spi_flash_get_id(void) {
     return W25Q32_FLASH_ID;
 }
 
+static void spi_flash_wait_idle(void) {
+    while(w25q32_busy() & W25Q32_STATUS_BUSY);
+}
+
 SpiFlashOpResult spi_flash_erase_sector(uint16_t sec) {
+    spi_flash_wait_idle();
     w25q32_sector_erase(sec * SPI_FLASH_SEC_SIZE);
     return SPI_FLASH_RESULT_OK;
 }
 
 SpiFlashOpResult spi_flash_write(uint32_t des_addr, uint32_t *src_addr, uint32_t size) {
+    spi_flash_wait_idle();
     w25q32_write_align(des_addr, src_addr, size);
     return SPI_FLASH_RESULT_OK;
 }
 
 SpiFlashOpResult spi_flash_read(uint32_t src_addr, uint32_t *des_addr, uint32_t size) {
+    spi_flash_wait_idle();
     w25q32_read_align(src_addr, des_addr, size);
     return SPI_FLASH_RESULT_OK;
 }
+
+SpiFlashOpResult spi_flash_erase_sector_start(uint16_t sec) {
+    w25q32_sector_erase_start(sec * SPI_FLASH_SEC_SIZE);
+    return SPI_FLASH_RESULT_OK;
+}
+
+/**
+ * @brief 块擦除
+ * @param sec 块首扇区编号, 需按块对齐
+ * @param secs 块扇区数, SPI_FLASH_BLOCK32_SECS或SPI_FLASH_BLOCK64_SECS
+ * */
+SpiFlashOpResult spi_flash_erase_block(uint16_t sec, uint16_t secs) {
+    if(((secs != SPI_FLASH_BLOCK32_SECS) && (secs != SPI_FLASH_BLOCK64_SECS)) || ((sec % secs) != 0)) {
+        return SPI_FLASH_RESULT_ERR;
+    }
+    spi_flash_wait_idle();
+    if(w25q32_block_erase(sec * SPI_FLASH_SEC_SIZE, secs * SPI_FLASH_SEC_SIZE) == 0x0) {
+        return SPI_FLASH_RESULT_ERR;
+    }
+    return SPI_FLASH_RESULT_OK;
+}
+
+uint8_t spi_flash_busy(void) {
+    return (w25q32_busy() & W25Q32_STATUS_BUSY);
+}
@@ -10,10 +10,16 @@ typedef enum {
 } SpiFlashOpResult;
 
 #define SPI_FLASH_SEC_SIZE      4096
+// 块擦除扇区数, 32KB块/64KB块
+#define SPI_FLASH_BLOCK32_SECS  8
+#define SPI_FLASH_BLOCK64_SECS  16
 
 uint32_t spi_flash_get_id(void);
 SpiFlashOpResult spi_flash_erase_sector(uint16_t sec);
 SpiFlashOpResult spi_flash_write(uint32_t des_addr, uint32_t *src_addr, uint32_t size);
 SpiFlashOpResult spi_flash_read(uint32_t src_addr, uint32_t *des_addr, uint32_t size);
+SpiFlashOpResult spi_flash_erase_sector_start(uint16_t sec);
+SpiFlashOpResult spi_flash_erase_block(uint16_t sec, uint16_t secs);
+uint8_t spi_flash_busy(void);
 
 #endif
@@ -1,30 +1,187 @@
 #include "spifs.h"
+#include "fbindex.h"
+#include "bitmap.h"
+#include "checkpoint.h"
 
-// FTL可擦除扇区Bitmap表, 0:扇区不可擦除(空白扇区或带数据扇区), 1:扇区可擦除(标记为SECTOR_DISCARD_FLAG)
-static uint32_t FTL_ERASABLE_TABLE[FTL_SIZE];
+/**
+ * @brief 页写入暂存区, 同一页内的扇区标记/数据/链表指针合并为一次页编程
+ */
+typedef struct _page_stage {
+    uint32_t page;                                   // 暂存页首地址, EMPTY_INT_VALUE:空
+    uint32_t low;                                    // 页内已写入范围起始偏移
+    uint32_t high;                                   // 页内已写入范围结束偏移(不含)
+    uint32_t buffer[PAGE_SIZE / sizeof(uint32_t)];   // 页缓冲区, 4字节对齐
+} PageStage;
+
+// 突发读中转缓冲区大小(字节), 不超过该长度的读取只需一次flash读操作
+#define READ_BOUNCE_SIZE    (128)
+
+// 扫描文件索引区时每次突发读取的文件块数量, 不超过一页
+#define FB_SCAN_SLOTS       (PAGE_SIZE / FILEBLOCK_SIZE)
+
+/**
+ * @brief 分散/聚集缓冲区游标, 段内数据用尽时移至下一段
+ */
+typedef struct _iov_cursor {
+    const SpifsIovec *iov;   // 当前段
+    uint32_t offset;         // 当前段内偏移
+} IovCursor;
+
+/**
+ * @brief 簇链扇区地址窗口, 随机偏移覆盖写向前处理时使用, addr[i]为第(base + i)个扇区首地址
+ */
+typedef struct _chain_window {
+    uint32_t base;                                   // 首项扇区序号, EMPTY_INT_VALUE:空
+    uint32_t top;                                    // 末项扇区序号, 其链表指针存于addr[top - base + 1]
+    uint32_t addr[SPIFS_COW_WINDOW_SECTORS + 1];
+} ChainWindow;
+
+#define STAGE_INIT(stage)    do { (stage).page = EMPTY_INT_VALUE; (stage).low = PAGE_SIZE; (stage).high = 0; } while(0)
+
+// 数据区GC每批选取的扇区数量
+#define GC_PICK_BATCH    (8)
+
+// 文件索引扇区中文件块占用的字节数, 扇区末尾不足一个文件块的部分不使用
+#define GC_FB_SLOTS_SIZE    (FB_SLOTS_PER_SECTOR * FILEBLOCK_SIZE)
+
+// 文件索引区最大扇区数, 由16位槽位编号限定, 决定GC已访问扇区位图大小
+#define GC_FB_SECTORS_MAX   (FB_SLOT_MAX / FB_SLOTS_PER_SECTOR)
+
+// API加锁模式: 只读API持读锁, 修改flash或RAM状态的API持写锁
+#define API_LOCK_READ     (0)
+#define API_LOCK_WRITE    (1)
+
+// API入口加锁: 公开API入口加锁、返回时解锁, 内部调用使用*_impl避免重复加锁, 未启用锁时为空
+#ifdef SPIFS_USE_LOCK
+#define LOCK_ENTER(mode)  uint8_t api_lock = api_lock_enter(fs, (mode))
+#define LOCK_RETURN(v)    api_lock_leave(fs, api_lock, (v))
+#define LOCK_LEAVE()      api_lock_leave(fs, api_lock, 0)
+#else
+#define LOCK_ENTER(mode)
+#define LOCK_RETURN(v)    (v)
+#define LOCK_LEAVE()
+#endif
 
-// FTL空白扇区Bitmap表, 0:扇区不是空白(带数据或标记为可擦除), 1:扇区空白(标记为EMPTY_INT_VALUE)
-static uint32_t FTL_WRITABLE_TABLE[FTL_SIZE];
+// API入口统计: flash操作计入最外层API, 未启用统计时仅加锁
+#ifdef SPIFS_USE_STATS
+#define API_ENTER(api, mode)    LOCK_ENTER(mode); uint32_t api_prev = stats_enter(fs, (api))
+#define API_RETURN(v)     LOCK_RETURN(stats_leave(fs, api_prev, (v)))
+#define API_LEAVE()       LOCK_RETURN(stats_leave(fs, api_prev, 0))
+#else
+#define API_ENTER(api, mode)    LOCK_ENTER(mode)
+#define API_RETURN(v)     LOCK_RETURN(v)
+#define API_LEAVE()       LOCK_LEAVE()
+#endif
 
 static uint32_t ICACHE_FLASH_ATTR strlen_ext(uint8_t *str, uint32_t max) ;
 
 static BOOL ICACHE_FLASH_ATTR fb_has_name(uint8_t *fb_buffer);
 
-static BOOL ICACHE_FLASH_ATTR find_empty_sector(uint32_t *secList, uint32_t nums);
+static BOOL ICACHE_FLASH_ATTR find_empty_sector(spifs_t *fs, uint32_t *secList, uint32_t nums);
 
 static BOOL ICACHE_FLASH_ATTR filename_equals(uint8_t *src, uint8_t *target, uint32_t length);
 
-static BOOL ICACHE_FLASH_ATTR open_file_impl(File *file, uint8_t *filename, uint8_t *extname, BOOL rawname);
+static Result ICACHE_FLASH_ATTR create_file_impl(spifs_t *fs, File *file, FileInfo *finfo);
+static Result ICACHE_FLASH_ATTR fileblock_create(spifs_t *fs, File *file, FileInfo *finfo);
+
+static Result ICACHE_FLASH_ATTR write_finish_impl(spifs_t *fs, File *file);
+
+static void ICACHE_FLASH_ATTR read_finfo_impl(spifs_t *fs, File *file, FileInfo *finfo);
+
+static uint32_t ICACHE_FLASH_ATTR gc_impl(spifs_t *fs, GCType tp, uint32_t nums);
+
+static uint32_t ICACHE_FLASH_ATTR avail_files_impl(spifs_t *fs);
+
+#ifdef SPIFS_USE_LOCK
+static uint8_t ICACHE_FLASH_ATTR api_lock_enter(spifs_t *fs, uint8_t mode);
+
+static uint32_t ICACHE_FLASH_ATTR api_lock_leave(spifs_t *fs, uint8_t mode, uint32_t value);
+#endif
+
+#ifdef SPIFS_USE_STATS
+static uint32_t ICACHE_FLASH_ATTR stats_enter(spifs_t *fs, uint32_t api);
+
+static uint32_t ICACHE_FLASH_ATTR stats_leave(spifs_t *fs, uint32_t prev, uint32_t value);
+#endif
+
+static BOOL ICACHE_FLASH_ATTR open_file_impl(spifs_t *fs, File *file, uint8_t *filename, uint8_t *extname, BOOL rawname);
+
+static Result ICACHE_FLASH_ATTR write_file_impl(spifs_t *fs, File *file, FileInfo *finfo, const SpifsIovec *iov, uint32_t length, WriteMethod method, uint32_t *tail);
+
+static Result ICACHE_FLASH_ATTR write_file_at_impl(spifs_t *fs, File *file, uint32_t offset, uint8_t *buffer, uint32_t length);
+
+static BOOL ICACHE_FLASH_ATTR cow_programmable(spifs_t *fs, uint32_t addr, const uint8_t *src, uint32_t size);
+static uint8_t * ICACHE_FLASH_ATTR cow_range(uint32_t index, uint32_t offset, uint32_t length, uint8_t *buffer, uint32_t *start, uint32_t *end);
+
+static void ICACHE_FLASH_ATTR cow_copy_sector(spifs_t *fs, uint32_t from, uint32_t to, uint32_t start, uint32_t end, const uint8_t *src, uint32_t link);
+
+static uint32_t ICACHE_FLASH_ATTR cow_pick_sector(spifs_t *fs, uint32_t addr);
+
+static void ICACHE_FLASH_ATTR cow_discard(spifs_t *fs, uint32_t addr, uint32_t count);
+static uint32_t ICACHE_FLASH_ATTR cow_chain_at(spifs_t *fs, File *file, ChainWindow *chain, uint32_t index, uint32_t *link);
+
+static uint32_t ICACHE_FLASH_ATTR read_file_impl(spifs_t *fs, File *file, ClusterCache *cache, uint32_t offset, const SpifsIovec *iov, uint32_t length, uint32_t *sec_index, uint32_t *sec_addr);
+
+static Result ICACHE_FLASH_ATTR rename_file_impl(spifs_t *fs, File *file, uint8_t *filename, uint8_t *extname, BOOL raw);
+
+static void ICACHE_FLASH_ATTR stage_write(spifs_t *fs, PageStage *stage, uint8_t *buffer, uint32_t offset, uint32_t write_addr, uint32_t write_size);
 
-static Result ICACHE_FLASH_ATTR rename_file_impl(File *file, uint8_t *filename, uint8_t *extname, BOOL raw);
+static void ICACHE_FLASH_ATTR stage_flush(spifs_t *fs, PageStage *stage);
 
-static void ICACHE_FLASH_ATTR align_write_impl(uint8_t *buffer, uint32_t offset, uint32_t write_addr, uint32_t write_size);
+static void ICACHE_FLASH_ATTR stage_write_iov(spifs_t *fs, PageStage *stage, IovCursor *src, uint32_t write_addr, uint32_t write_size);
 
-static void ICACHE_FLASH_ATTR align_read_impl(uint8_t *buffer, uint32_t offset, uint32_t read_addr, uint32_t read_size);
+static uint32_t ICACHE_FLASH_ATTR burst_read(spifs_t *fs, uint8_t *buffer, uint32_t read_addr, uint32_t read_size, BOOL link);
 
-static void spifs_ftl_mark(uint32_t *table, uint32_t position, uint32_t bitValue);
+static uint32_t ICACHE_FLASH_ATTR burst_read_iov(spifs_t *fs, IovCursor *dst, uint32_t read_addr, uint32_t read_size, BOOL link);
 
-static uint32_t spifs_ftl_get(uint32_t *table, uint32_t position);
+static void spifs_ftl_mark(spifs_t *fs, FtlTable *table, uint32_t position, uint32_t bitValue);
+
+
+static void ICACHE_FLASH_ATTR ftl_clear(spifs_t *fs);
+
+static void ICACHE_FLASH_ATTR fileblock_retire(spifs_t *fs, File *file, uint8_t fstate);
+
+static uint32_t ICACHE_FLASH_ATTR cluster_seek(spifs_t *fs, File *file, ClusterCache *cache, uint32_t index);
+
+
+static uint32_t ICACHE_FLASH_ATTR ftl_pick(spifs_t *fs, FtlTable *table, uint32_t *secList, uint32_t nums, uint32_t *cursor);
+
+#ifdef SPIFS_USE_WEAR_LEVELING
+#endif
+
+static void ICACHE_FLASH_ATTR data_sector_erase(spifs_t *fs, uint32_t sec);
+
+static void ICACHE_FLASH_ATTR data_sector_erased(spifs_t *fs, uint32_t sec);
+
+static void ICACHE_FLASH_ATTR data_run_erase(spifs_t *fs, uint32_t start, uint32_t end);
+
+static void ICACHE_FLASH_ATTR flash_erase_run(spifs_t *fs, uint32_t start, uint32_t end);
+
+static void ICACHE_FLASH_ATTR reserve_finish(spifs_t *fs);
+
+static uint32_t ICACHE_FLASH_ATTR sector_mark(spifs_t *fs, uint32_t secAddr, uint32_t flag);
+
+static void ICACHE_FLASH_ATTR spifs_fb_scan(spifs_t *fs);
+
+static void ICACHE_FLASH_ATTR ftl_region_load(spifs_t *fs, uint32_t region);
+
+static void ICACHE_FLASH_ATTR ftl_load_all(spifs_t *fs);
+
+static void ICACHE_FLASH_ATTR ftl_load_writable(spifs_t *fs, uint32_t nums);
+
+static void ICACHE_FLASH_ATTR spifs_fb_ensure(spifs_t *fs);
+
+static uint32_t ICACHE_FLASH_ATTR gc_pick_fb_sector(spifs_t *fs, uint32_t *visited);
+
+static uint32_t ICACHE_FLASH_ATTR gc_fileblock_sector(spifs_t *fs, uint32_t sec);
+
+static uint32_t ICACHE_FLASH_ATTR gc_fileblock_slots(spifs_t *fs, uint32_t sec, uint32_t offset, uint8_t *buffer, uint32_t size);
+
+static uint32_t ICACHE_FLASH_ATTR gc_data_sectors(spifs_t *fs, uint32_t nums);
+
+static uint32_t ICACHE_FLASH_ATTR gc_data_blocks(spifs_t *fs, uint32_t nums);
+
+static BOOL ICACHE_FLASH_ATTR list_filter_match(FileBlock *fb, const SpifsListFilter *filter);
 
 /**
  * @brief 配置文件信息字段
@@ -90,32 +247,63 @@ BOOL ICACHE_FLASH_ATTR make_file(File *file, char *filename, char *extname) {
  * @param *finfo 文件信息字段
  * @return Result
  * */
-Result ICACHE_FLASH_ATTR create_file(File *file, FileInfo *finfo) {
+Result ICACHE_FLASH_ATTR create_file(spifs_t *fs, File *file, FileInfo *finfo) {
+    API_ENTER(SPIFS_API_CREATE_FILE, API_LOCK_WRITE);
+    return API_RETURN(create_file_impl(fs, file, finfo));
+}
+
+/**
+ * @brief 创建文件实现, 查重与写入文件块在同一次加锁内完成
+ * @param *file 文件指针
+ * @param *finfo 文件信息字段
+ * @return Result
+ * */
+static Result ICACHE_FLASH_ATTR create_file_impl(spifs_t *fs, File *file, FileInfo *finfo) {
     File temp_file;
-    FileBlock *fb = NULL;
-    // stack allocated aligned with 4 bytes
-    uint8_t fb_buffer[FILEBLOCK_SIZE];
-    uint32_t fb_index, addr_start, addr_end;
-    BOOL find_empty_sector = FALSE;
 
 #ifdef SPIFS_USE_NULL_CHECK
     if(file == NULL || finfo == NULL) {
         return FILE_NOT_EXIST;
     }
 #endif
+    spifs_fb_ensure(fs);
 
     // 检查该文件名/拓展名的文件是否已经存在
-    if(open_file_impl(&temp_file, file->filename, file->extname, TRUE)) {
+    if(open_file_impl(fs, &temp_file, file->filename, file->extname, TRUE)) {
         // 同名文件已经存在
         return FILE_ALREADY_EXIST;
     }
+    return fileblock_create(fs, file, finfo);
+}
+
+/**
+ * @brief 分配空闲文件块并写入, 不检查同名文件, 文件索引区空间不足时执行文件块GC
+ * @param *file 文件指针, 写入成功后file->block指向新文件块
+ * @param *finfo 文件信息字段
+ * @return CREATE_FILE_SUCCESS or NO_FILEBLOCK_SPACE
+ * */
+static Result ICACHE_FLASH_ATTR fileblock_create(spifs_t *fs, File *file, FileInfo *finfo) {
+    FileBlock *fb = NULL;
+    // stack allocated aligned with 4 bytes
+    uint8_t fb_buffer[FILEBLOCK_SIZE];
+    uint32_t fb_index, addr_start, addr_end;
+    BOOL find_empty_sector = FALSE;
 
     FIND_FB_SPACE:
-    for(fb_index = FB_SECTOR_START; (fb_index < (FB_SECTOR_END + 1)) && (!find_empty_sector); fb_index++) {
+#ifdef SPIFS_USE_FB_SLOTMAP
+    if(fb_slots_ready(fs)) {
+        fb_index = fb_slots_find_free(fs);
+        if(fb_index != EMPTY_INT_VALUE) {
+            addr_start = fb_slot_addr(fs, fb_index);
+            find_empty_sector = TRUE;
+        }
+    }
+#endif
+    for(fb_index = fs->fb_start; (fb_index < (fs->fb_end + 1)) && (!find_empty_sector); fb_index++) {
         addr_start = fb_index * SECTOR_SIZE;
         addr_end = (addr_start + SECTOR_SIZE);
         while((addr_end - addr_start) >= FILEBLOCK_SIZE) {
-            spi_flash_read(addr_start, (uint32_t *)fb_buffer, FILEBLOCK_SIZE);
+            spifs_flash_read(fs, addr_start, (uint32_t *)fb_buffer, FILEBLOCK_SIZE);
             // check filename and extname
             if(!fb_has_name(fb_buffer)) {
                 find_empty_sector = TRUE;
@@ -127,7 +315,7 @@ Result ICACHE_FLASH_ATTR create_file(File *file, FileInfo *finfo) {
 
     // run gc
     if(!find_empty_sector) {
-        if(spifs_gc(GC_TYPE_FILEBLOCK, 1) >= 1) {
+        if(gc_impl(fs, GC_TYPE_FILEBLOCK, 1) >= 1) {
         	goto FIND_FB_SPACE;
         }else {
         	return NO_FILEBLOCK_SPACE;
@@ -148,7 +336,13 @@ Result ICACHE_FLASH_ATTR create_file(File *file, FileInfo *finfo) {
         file->cluster = fb->cluster;
         file->length = fb->length;
     }
-    write_fileblock(addr_start, fb);
+    write_fileblock(fs, addr_start, fb);
+#ifdef SPIFS_USE_FB_INDEX
+    fb_index_insert(fs, addr_start, fb->filename);
+#endif
+#ifdef SPIFS_USE_FB_SLOTMAP
+    fb_slots_set(fs, fb_slot_index(fs, addr_start), FB_SLOT_LIVE);
+#endif
     file->block = addr_start;
     // 成功
     return CREATE_FILE_SUCCESS;
@@ -164,49 +358,147 @@ Result ICACHE_FLASH_ATTR create_file(File *file, FileInfo *finfo) {
  * @param method 写入方式
  * @return Result
  * */
-Result ICACHE_FLASH_ATTR write_file(File *file, uint8_t *buffer, uint32_t length, WriteMethod method) {
+Result ICACHE_FLASH_ATTR write_file(spifs_t *fs, File *file, uint8_t *buffer, uint32_t length, WriteMethod method) {
     FileInfo finfo;
-    uint32_t offset = 0, i = 0, write_addr = 0;
-    uint32_t *sector_list, sectors;
-    uint32_t leftsize = 0, write_size, temp;
+    SpifsIovec seg;
+    API_ENTER(SPIFS_API_WRITE_FILE, API_LOCK_WRITE);
 #ifdef SPIFS_USE_NULL_CHECK
     // 空指针检查
     if(file == NULL || buffer == NULL || file->block == EMPTY_INT_VALUE) {
-        return FILE_NOT_EXIST;
+        return API_RETURN(FILE_NOT_EXIST);
+    }
+#endif
+
+    read_finfo_impl(fs, file, &finfo);
+    // 权限检查
+    if(!(finfo.state.del & finfo.state.dep & finfo.state.rw)) {
+        return API_RETURN(CANNOT_WRITE_FILE);
+    }
+    seg.base = buffer;
+    seg.length = length;
+    return API_RETURN(write_file_impl(fs, file, &finfo, &seg, length, method, NULL));
+}
+
+/**
+ * @brief 分散写文件, 各段数据依次写入, 效果等同于将各段拼接后调用write_file
+ * @brief 各段直接合并到页缓冲区编程, 无需调用者拼接; 簇链定位与扇区分配只执行一次
+ * @param *file 文件指针
+ * @param *iov 数据段数组
+ * @param iovcnt 数据段数量
+ * @param method 写入方式
+ * @return Result
+ * */
+Result ICACHE_FLASH_ATTR write_file_v(spifs_t *fs, File *file, const SpifsIovec *iov, uint32_t iovcnt, WriteMethod method) {
+    FileInfo finfo;
+    uint32_t i, length = 0;
+    API_ENTER(SPIFS_API_WRITE_FILE, API_LOCK_WRITE);
+#ifdef SPIFS_USE_NULL_CHECK
+    if(file == NULL || iov == NULL || file->block == EMPTY_INT_VALUE) {
+        return API_RETURN(FILE_NOT_EXIST);
+    }
+#endif
+    for(i = 0; i < iovcnt; i++) {
+#ifdef SPIFS_USE_NULL_CHECK
+        if(iov[i].base == NULL && iov[i].length > 0) {
+            return API_RETURN(FILE_NOT_EXIST);
+        }
+#endif
+        length += iov[i].length;
+    }
+
+    read_finfo_impl(fs, file, &finfo);
+    // 权限检查
+    if(!(finfo.state.del & finfo.state.dep & finfo.state.rw)) {
+        return API_RETURN(CANNOT_WRITE_FILE);
+    }
+    return API_RETURN(write_file_impl(fs, file, &finfo, iov, length, method, NULL));
+}
+
+/**
+ * @brief 随机偏移覆盖写, 改写文件中[offset, offset + length)范围内的数据, 文件长度不变
+ * @brief 新数据相对原数据只需将1写为0时原位编程; 否则仅将受影响扇区复制到空白扇区并写入新数据(写时复制),
+ * @brief 再改写前驱扇区的链表指针, 指针无法原位编程时前驱扇区一并复制, 直至文件索引块首簇地址
+ * @brief 最坏情况: 最后一个需要复制的扇区为文件第h个扇区(以0为基准)时, 第0~h个扇区全部被复制, 需要h + 1个空白扇区,
+ * @brief 写入前按该数量检查空白扇区, 不足时一次同步回收废弃扇区, 仍不足返回NO_SECTOR_SPACE且不改写flash;
+ * @brief 新副本优先选取扇区号为原扇区号按位子集的空白扇区, 此时前驱指针可原位改写, 复制在该处终止
+ * @brief 扇区被复制后, 此前打开的文件句柄/其他File副本中缓存的扇区地址失效, 需重新打开; 文件块地址可能变化
+ * @param *file 文件指针
+ * @param offset 文件偏移量, 以0为基准
+ * @param *buffer 写入数据缓冲区, 无需4字节对齐
+ * @param length 写入字节数, offset + length不超过文件长度
+ * @return WRITE_FILE_SUCCESS 成功, FILE_OFFSET_OUT_OF_BOUNDS 超出文件长度, NO_SECTOR_SPACE 空白扇区不足最坏情况所需数量(文件不变)
+ * */
+Result ICACHE_FLASH_ATTR write_file_at(spifs_t *fs, File *file, uint32_t offset, uint8_t *buffer, uint32_t length) {
+    FileInfo finfo;
+    API_ENTER(SPIFS_API_WRITE_FILE, API_LOCK_WRITE);
+#ifdef SPIFS_USE_NULL_CHECK
+    if(file == NULL || buffer == NULL || file->block == EMPTY_INT_VALUE) {
+        return API_RETURN(FILE_NOT_EXIST);
     }
 #endif
 
-    read_finfo(file, &finfo);
+    read_finfo_impl(fs, file, &finfo);
     // 权限检查
     if(!(finfo.state.del & finfo.state.dep & finfo.state.rw)) {
-        return CANNOT_WRITE_FILE;
+        return API_RETURN(CANNOT_WRITE_FILE);
     }
+    if(length == 0) {
+        return API_RETURN(WRITE_FILE_SUCCESS);
+    }
+    if((file->cluster == EMPTY_INT_VALUE) || (file->length == EMPTY_INT_VALUE)
+            || (offset >= file->length) || (length > (file->length - offset))) {
+        return API_RETURN(FILE_OFFSET_OUT_OF_BOUNDS);
+    }
+    return API_RETURN(write_file_at_impl(fs, file, offset, buffer, length));
+}
+
+/**
+ * @brief 写文件实现, 调用者完成权限检查
+ * @param *file 文件指针
+ * @param *finfo 文件信息, 覆盖写重建文件索引块时使用
+ * @param *iov 写入数据段数组, 各段长度之和不小于length
+ * @param length 写入字节数
+ * @param method 写入方式
+ * @param *tail 最后一个扇区首地址, 可为NULL; 追加写时若不为EMPTY_INT_VALUE则跳过簇链定位, 返回时更新为写入后的最后一个扇区
+ * @return Result
+ * */
+static Result ICACHE_FLASH_ATTR write_file_impl(spifs_t *fs, File *file, FileInfo *finfo, const SpifsIovec *iov, uint32_t length, WriteMethod method, uint32_t *tail) {
+    uint32_t i = 0, write_addr = 0;
+    uint32_t batch[SPIFS_WRITE_BATCH_SECTORS], picked, pos, sector = 0, sectors;
+    uint32_t leftsize = 0, write_size, temp;
+    PageStage stage;
+    IovCursor src;
+
+    STAGE_INIT(stage);
+    src.iov = iov;
+    src.offset = 0;
+
     // 文件存在数据则标记数据扇区
     if(method == OVERRIDE && (file->cluster != EMPTY_INT_VALUE)) {
         // 根据链表标记文件占用扇区废弃
         while(file->cluster != EMPTY_INT_VALUE) {
-        	spifs_ftl_mark(FTL_ERASABLE_TABLE, (file->cluster / SECTOR_SIZE), FTL_MARK);
-            update_sector_mark(file->cluster, SECTOR_DISCARD_FLAG);
-            spi_flash_read((file->cluster + DATA_AREA_SIZE + SECTOR_MARK_SIZE), &temp, sizeof(uint32_t));
+        	spifs_ftl_mark(fs, &fs->ftl_erasable, (file->cluster / SECTOR_SIZE), FTL_MARK);
+            update_sector_mark(fs, file->cluster, sector_mark(fs, file->cluster, SECTOR_DISCARD_FLAG));
+            spifs_flash_read(fs, (file->cluster + DATA_AREA_SIZE + SECTOR_MARK_SIZE), &temp, sizeof(uint32_t));
             file->cluster = temp;
         }
         file->length = EMPTY_INT_VALUE;
         // 标记文件索引表对应文件块失效，但不执行擦除操作
-        write_fileblock_state(file->block, FSTATE_DEPRECATE);
+        fileblock_retire(fs, file, FSTATE_DEPRECATE);
         // 重新创建文件索引块
-        if(CREATE_FILE_SUCCESS != create_file(file, &finfo)) {
+        if(CREATE_FILE_SUCCESS != create_file_impl(fs, file, finfo)) {
             return NO_FILEBLOCK_SPACE;
         }
     }else if(method == APPEND && (file->cluster != EMPTY_INT_VALUE) && (file->length != EMPTY_INT_VALUE)) {
-    	// 遍历扇区链表，找到最后一个扇区
-		write_addr = file->cluster;
-		while(write_addr != EMPTY_INT_VALUE) {
-			spi_flash_read((write_addr + SECTOR_MARK_SIZE + DATA_AREA_SIZE), &temp, sizeof(uint32_t));
-			if(temp == EMPTY_INT_VALUE) {
-				break;
-			}
-			write_addr = temp;
-		}
+    	// 根据文件长度定位最后一个扇区, 调用者已知尾扇区时直接使用
+    	if(tail != NULL && *tail != EMPTY_INT_VALUE) {
+    		write_addr = *tail;
+    	}else {
+    		write_addr = (file->length == 0) ? file->cluster : cluster_seek(fs, file, NULL, ((file->length - 1) / DATA_AREA_SIZE));
+    		if(tail != NULL) {
+    			*tail = write_addr;
+    		}
+    	}
     	// 判断当前扇区使用空间
 		if((temp = (file->length % DATA_AREA_SIZE)) == 0) {
 			write_addr += (SECTOR_MARK_SIZE + DATA_AREA_SIZE);
@@ -216,13 +508,13 @@ Result ICACHE_FLASH_ATTR write_file(File *file, uint8_t *buffer, uint32_t length
 		leftsize = (DATA_AREA_SIZE - temp);
 		write_addr += (SECTOR_MARK_SIZE + temp);
 		write_size = (length < leftsize) ? length : leftsize;
-		align_write_impl(buffer, offset, write_addr, write_size);
+		stage_write_iov(fs, &stage, &src, write_addr, write_size);
 		// 地址更新
-		offset += write_size;
 		write_addr += write_size;
 		length -= write_size;
 		file->length += write_size;
 		if(length <= 0) {
+			stage_flush(fs, &stage);
 			return APPEND_FILE_SUCCESS;
 		}
     }
@@ -233,108 +525,415 @@ NEXT_PART_WRITE:
     if((sectors * DATA_AREA_SIZE) < length) {
     	sectors += 1;
     }
-    // 扇区首地址记录表
-    sector_list = (uint32_t *)os_malloc(sizeof(uint32_t) * sectors);
-
-    // 查找空闲扇区
-    do {
-    	if(find_empty_sector(sector_list, sectors)) {
-    		break;
-    	}
-    	if(spifs_gc(GC_TYPE_DATAAREA, sectors) >= sectors) {
-    		find_empty_sector(sector_list, sectors);
-    		break;
-    	}
-    	os_free(sector_list);
+    // 先确认空闲扇区总数足够, 再按批次取出, 不足时仅同步回收缺少的扇区数量, 限制前台写入阻塞时间
+    ftl_load_writable(fs, sectors);
+    if(fs->ftl_writable.count < sectors) {
+    	gc_data_sectors(fs, sectors - fs->ftl_writable.count);
+    	ftl_load_writable(fs, sectors);
+    }
+    picked = (sectors < SPIFS_WRITE_BATCH_SECTORS) ? sectors : SPIFS_WRITE_BATCH_SECTORS;
+    if((fs->ftl_writable.count < sectors) || !find_empty_sector(fs, batch, picked)) {
+    	stage_flush(fs, &stage);
     	return NO_SECTOR_SPACE;
-    }while(0);
+    }
 
     // 更新文件索引信息
     if(method == OVERRIDE) {
-        write_fileblock_cluster(file->block, sector_list[0]);
-        write_fileblock_length(file->block, length);
-        file->cluster = sector_list[0];
+        write_fileblock_extent(fs, file->block, batch[0], length);
+        file->cluster = batch[0];
         file->length = length;
     }else {
         if(file->cluster == EMPTY_INT_VALUE) {
         	// 对空文件追加, 仅写入首簇号
-            write_fileblock_cluster(file->block, sector_list[0]);
-            file->cluster = sector_list[0];
+            write_fileblock_cluster(fs, file->block, batch[0]);
+            file->cluster = batch[0];
             file->length = length;
         }else {
-            spi_flash_write(write_addr, (sector_list + 0), sizeof(uint32_t));
+            // 链接到尾扇区, 与尾扇区剩余数据在同一页时合并编程
+            stage_write(fs, &stage, (uint8_t *)batch, 0, write_addr, sizeof(uint32_t));
             file->length += length;
         }
     }
 
-    for(i = 0; i < sectors; i++) {
+    for(i = 0, pos = 0; i < sectors; i++) {
+        sector = batch[pos++];
         // 写入地址偏移4字节
-        write_addr = (sector_list[i] + SECTOR_MARK_SIZE);
-        // 写占用标记
-        update_sector_mark(sector_list[i], SECTOR_INUSE_FLAG);
-        spifs_ftl_mark(FTL_WRITABLE_TABLE, (sector_list[i] / SECTOR_SIZE), FTL_UNMARK);
+        write_addr = (sector + SECTOR_MARK_SIZE);
+        // 写占用标记, 与扇区首页数据合并编程
+        temp = sector_mark(fs, sector, SECTOR_INUSE_FLAG);
+        stage_write(fs, &stage, (uint8_t *)&temp, 0, sector, sizeof(uint32_t));
+        spifs_ftl_mark(fs, &fs->ftl_writable, (sector / SECTOR_SIZE), FTL_UNMARK);
 
         write_size = (length >= DATA_AREA_SIZE) ? DATA_AREA_SIZE : length;
-        align_write_impl(buffer, offset, write_addr, write_size);
+        stage_write_iov(fs, &stage, &src, write_addr, write_size);
 
         if((write_size >= DATA_AREA_SIZE) && ((i + 1) < sectors)) {
+        	// 本批次用完时取下一批, 空闲扇区总数已在写入前确认
+        	if(pos == picked) {
+        		picked = ((sectors - i - 1) < SPIFS_WRITE_BATCH_SECTORS) ? (sectors - i - 1) : SPIFS_WRITE_BATCH_SECTORS;
+        		find_empty_sector(fs, batch, picked);
+        		pos = 0;
+        	}
         	// 除了最后一个扇区，其余扇区都需要在最后四字节写入下一扇区首地址，形成单链表
-			spi_flash_write((write_addr + DATA_AREA_SIZE), (sector_list + i + 1), sizeof(uint32_t));
+        	stage_write(fs, &stage, (uint8_t *)(batch + pos), 0, (write_addr + DATA_AREA_SIZE), sizeof(uint32_t));
         }
-        offset += write_size;
+        length -= write_size;
     }
+    stage_flush(fs, &stage);
 
-    os_free(sector_list);
+    if(tail != NULL) {
+        *tail = sector;
+    }
 
     return ((method == OVERRIDE) ? WRITE_FILE_SUCCESS : APPEND_FILE_SUCCESS);
 }
 
 /**
+ * @brief 随机偏移覆盖写实现, 调用者完成权限与范围检查
+ * @brief 从最后一个受影响扇区向前处理, 连续复制的扇区构成一段, 前驱链表指针(或首簇地址)切换到新副本后再废弃旧扇区,
+ * @brief 切换前掉电时文件仍指向完整的旧扇区; 需重建文件索引块时先写入新文件块再标记旧文件块失效
+ * @brief 写入flash前先找出最后一个需要复制的扇区(序号h), 按最坏情况h + 1个空白扇区一次性同步回收不足部分, 仍不足时直接返回
+ * @param *file 文件指针
+ * @param offset 文件偏移量
+ * @param *buffer 写入数据缓冲区
+ * @param length 写入字节数, 大于0
+ * @return Result
+ * */
+static Result ICACHE_FLASH_ATTR write_file_at_impl(spifs_t *fs, File *file, uint32_t offset, uint8_t *buffer, uint32_t length) {
+    FileBlock fblock;
+    FileInfo finfo;
+    File retired;
+    PageStage stage;
+    ChainWindow chain;
+    uint32_t index, first, last, addr, link, start, end, to, need = 0;
+    uint32_t next = EMPTY_INT_VALUE, run_old = EMPTY_INT_VALUE, run_new = EMPTY_INT_VALUE, run_len = 0;
+    BOOL inplace;
+    uint8_t *src;
+
+    STAGE_INIT(stage);
+    chain.base = EMPTY_INT_VALUE;
+    first = (offset / DATA_AREA_SIZE);
+    last = ((offset + length - 1) / DATA_AREA_SIZE);
+
+    // 向前查找第一个不能原位编程的扇区, 最坏情况下它与其前的全部扇区都需要复制
+    for(index = last; ; index--) {
+        addr = cow_chain_at(fs, file, &chain, index, &link);
+        src = cow_range(index, offset, length, buffer, &start, &end);
+        if(!cow_programmable(fs, (addr + SECTOR_MARK_SIZE + start), src, (end - start))) {
+            need = (index + 1);
+            break;
+        }
+        if(index <= first) {
+            break;
+        }
+    }
+    // 空白扇区不足时一次同步回收缺少的数量, 不在复制过程中逐个回收
+    if(need > 0) {
+        ftl_load_writable(fs, need);
+        if(fs->ftl_writable.count < need) {
+            gc_data_sectors(fs, need - fs->ftl_writable.count);
+            ftl_load_writable(fs, need);
+        }
+        if(fs->ftl_writable.count < need) {
+            return NO_SECTOR_SPACE;
+        }
+    }
+
+    for(index = last; ; index--) {
+        addr = cow_chain_at(fs, file, &chain, index, &link);
+        src = cow_range(index, offset, length, buffer, &start, &end);
+        if(index >= need) {
+            // 预查已确认可原位编程, 此时尚无复制的后继扇区
+            inplace = TRUE;
+        }else if((index + 1) == need) {
+            inplace = FALSE;
+        }else {
+            inplace = (((next == EMPTY_INT_VALUE) || ((next & link) == next))
+                    && ((start == end) || cow_programmable(fs, (addr + SECTOR_MARK_SIZE + start), src, (end - start))));
+        }
+
+        if(inplace) {
+            // 原位编程, 后继扇区已复制时同时改写链表指针
+            if(end > start) {
+                stage_write(fs, &stage, src, 0, (addr + SECTOR_MARK_SIZE + start), (end - start));
+            }
+            if(next != EMPTY_INT_VALUE) {
+                stage_write(fs, &stage, (uint8_t *)&next, 0, (addr + SECTOR_MARK_SIZE + DATA_AREA_SIZE), sizeof(uint32_t));
+            }
+            stage_flush(fs, &stage);
+            // 链表已切换到新副本, 废弃被替换的旧扇区
+            cow_discard(fs, run_old, run_len);
+            run_len = 0;
+            next = EMPTY_INT_VALUE;
+            if(index <= first) {
+                break;
+            }
+            continue;
+        }
+
+        // 写时复制, 新副本链接到后继扇区的新副本或原后继扇区
+        to = cow_pick_sector(fs, addr);
+        if(to == EMPTY_INT_VALUE) {
+            cow_discard(fs, run_new, run_len);
+            return NO_SECTOR_SPACE;
+        }
+        cow_copy_sector(fs, addr, to, start, end, src, ((next == EMPTY_INT_VALUE) ? link : next));
+        run_old = addr;
+        run_new = to;
+        run_len++;
+        next = to;
+        if(index == 0) {
+            break;
+        }
+    }
+
+    if(run_len > 0) {
+        // 首扇区已复制, 首簇地址可原位编程时直接改写, 否则重建文件索引块
+        spifs_flash_read(fs, file->block, (uint32_t *)&fblock, sizeof(FileBlock));
+        if((next & fblock.cluster) == next) {
+            write_fileblock_cluster(fs, file->block, next);
+            file->cluster = next;
+        }else {
+            // 新文件块写入成功前旧文件块保持有效, 失败时文件不变
+            read_finfo_impl(fs, file, &finfo);
+            os_memcpy(&retired, file, sizeof(File));
+            file->cluster = next;
+            if(fileblock_create(fs, file, &finfo) != CREATE_FILE_SUCCESS) {
+                os_memcpy(file, &retired, sizeof(File));
+                cow_discard(fs, run_new, run_len);
+                return NO_FILEBLOCK_SPACE;
+            }
+            fileblock_retire(fs, &retired, FSTATE_DEPRECATE);
+        }
+        cow_discard(fs, run_old, run_len);
+    }
+    return WRITE_FILE_SUCCESS;
+}
+
+/**
+ * @brief 计算第index个扇区数据区内的写入范围[start, end), 不在写入范围内的扇区start与end均为0
+ * @return 该扇区对应的写入数据, 不在写入范围内时为NULL
+ * */
+static uint8_t * ICACHE_FLASH_ATTR cow_range(uint32_t index, uint32_t offset, uint32_t length, uint8_t *buffer, uint32_t *start, uint32_t *end) {
+    uint32_t first = (offset / DATA_AREA_SIZE), last = ((offset + length - 1) / DATA_AREA_SIZE);
+
+    if(index < first) {
+        *start = 0;
+        *end = 0;
+        return NULL;
+    }
+    *start = (index == first) ? (offset % DATA_AREA_SIZE) : 0;
+    *end = (index == last) ? ((offset + length - 1) % DATA_AREA_SIZE + 1) : DATA_AREA_SIZE;
+    return (buffer + (index * DATA_AREA_SIZE + *start - offset));
+}
+
+/**
+ * @brief 检查新数据能否原位编程, 即flash原数据与新数据按位与后等于新数据(仅需将1写为0)
+ * @param addr flash地址, 无需4字节对齐
+ * @param *src 新数据
+ * @param size 数据长度
+ * @return TRUE: 可原位编程
+ * */
+static BOOL ICACHE_FLASH_ATTR cow_programmable(spifs_t *fs, uint32_t addr, const uint8_t *src, uint32_t size) {
+    uint32_t window[PAGE_SIZE / sizeof(uint32_t)];
+    uint8_t *old = (uint8_t *)window;
+    uint32_t base, skew, chunk, i;
+
+    while(size > 0) {
+        base = (addr & ~(uint32_t)0x3);
+        skew = (addr - base);
+        chunk = ((PAGE_SIZE - skew) < size) ? (PAGE_SIZE - skew) : size;
+        spifs_flash_read(fs, base, window, ((skew + chunk + 3) & ~(uint32_t)0x3));
+        for(i = 0; i < chunk; i++) {
+            if((old[skew + i] & src[i]) != src[i]) {
+                return FALSE;
+            }
+        }
+        addr += chunk;
+        src += chunk;
+        size -= chunk;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief 逐页复制扇区到空白扇区, 复制时替换扇区标记字/写入范围内的数据/链表指针, 全空页不编程
+ * @param from 原扇区首地址
+ * @param to 空白扇区首地址
+ * @param start 数据区内写入起始偏移
+ * @param end 数据区内写入结束偏移(不含), 与start相等时不写入新数据
+ * @param *src 写入数据
+ * @param link 新副本的链表指针
+ * */
+static void ICACHE_FLASH_ATTR cow_copy_sector(spifs_t *fs, uint32_t from, uint32_t to, uint32_t start, uint32_t end, const uint8_t *src, uint32_t link) {
+    uint32_t page[PAGE_SIZE / sizeof(uint32_t)];
+    uint32_t pos, low, high, i;
+
+    for(pos = 0; pos < SECTOR_SIZE; pos += PAGE_SIZE) {
+        spifs_flash_read(fs, (from + pos), page, PAGE_SIZE);
+        if(pos == 0) {
+            page[0] = sector_mark(fs, to, SECTOR_INUSE_FLAG);
+        }
+        // 写入范围与本页重叠部分
+        low = ((SECTOR_MARK_SIZE + start) > pos) ? (SECTOR_MARK_SIZE + start) : pos;
+        high = ((SECTOR_MARK_SIZE + end) < (pos + PAGE_SIZE)) ? (SECTOR_MARK_SIZE + end) : (pos + PAGE_SIZE);
+        if(low < high) {
+            os_memcpy(((uint8_t *)page + (low - pos)), (src + (low - SECTOR_MARK_SIZE - start)), (high - low));
+        }
+        if((pos + PAGE_SIZE) == SECTOR_SIZE) {
+            page[(PAGE_SIZE / sizeof(uint32_t)) - 1] = link;
+        }
+        for(i = 0; (i < (PAGE_SIZE / sizeof(uint32_t))) && (page[i] == EMPTY_INT_VALUE); i++);
+        if(i < (PAGE_SIZE / sizeof(uint32_t))) {
+            spifs_flash_write(fs, (to + pos), page, PAGE_SIZE);
+        }
+    }
+}
+
+/**
+ * @brief 为写时复制选取空白扇区并从FTL表中取出
+ * @brief 优先选取扇区号为原扇区号按位子集的扇区, 前驱链表指针/首簇地址只需将1写为0即可原位改写, 避免继续向前复制;
+ * @brief 启用磨损均衡时该扇区擦除次数不超过原扇区 + SPIFS_WEAR_THRESHOLD; 没有空白的子集扇区时按常规分配,
+ * @brief 不回收扇区, 空白扇区已由调用者按最坏情况预先备足
+ * @param addr 原扇区首地址
+ * @return 扇区首地址, 无空白扇区时返回EMPTY_INT_VALUE
+ * */
+static uint32_t ICACHE_FLASH_ATTR cow_pick_sector(spifs_t *fs, uint32_t addr) {
+    uint32_t sec = (addr / SECTOR_SIZE), sub;
+
+    ftl_load_writable(fs, 1);
+    for(sub = ((sec - 1) & sec); (sub != 0) && (sub >= fs->data_start); sub = ((sub - 1) & sec)) {
+#ifdef SPIFS_USE_WEAR_LEVELING
+        if(fs->erase_count[sub - fs->data_start] > (fs->erase_count[sec - fs->data_start] + SPIFS_WEAR_THRESHOLD)) {
+            continue;
+        }
+#endif
+        if(BITMAP_GET(fs->ftl_writable.map, (sub - fs->data_start))) {
+            spifs_ftl_mark(fs, &fs->ftl_writable, sub, FTL_UNMARK);
+            return (sub * SECTOR_SIZE);
+        }
+    }
+    if(find_empty_sector(fs, &sub, 1)) {
+        return sub;
+    }
+    return EMPTY_INT_VALUE;
+}
+
+/**
+ * @brief 取簇链中第index个扇区首地址及其链表指针
+ * @brief 不在窗口内时从首簇遍历一次, 窗口改为以index为末项的至多SPIFS_COW_WINDOW_SECTORS个扇区, 之后向前访问无需再读flash
+ * @param *file 文件指针, file->cluster不为空
+ * @param *chain 扇区地址窗口, 首次使用前base置为EMPTY_INT_VALUE
+ * @param index 扇区序号, 以0为基准
+ * @param *link 返回该扇区的链表指针
+ * @return 扇区首地址
+ * */
+static uint32_t ICACHE_FLASH_ATTR cow_chain_at(spifs_t *fs, File *file, ChainWindow *chain, uint32_t index, uint32_t *link) {
+    uint32_t addr = file->cluster, i;
+
+    if((chain->base == EMPTY_INT_VALUE) || (index < chain->base) || (index > chain->top)) {
+        chain->base = (index >= SPIFS_COW_WINDOW_SECTORS) ? (index + 1 - SPIFS_COW_WINDOW_SECTORS) : 0;
+        chain->top = index;
+        for(i = 0; i < chain->base; i++) {
+            spifs_flash_read(fs, (addr + SECTOR_MARK_SIZE + DATA_AREA_SIZE), &addr, sizeof(uint32_t));
+        }
+        chain->addr[0] = addr;
+        // 读到第index个扇区的链表指针为止, 不越过文件末扇区
+        for(i = 0; i < (index - chain->base + 1); i++) {
+            spifs_flash_read(fs, (chain->addr[i] + SECTOR_MARK_SIZE + DATA_AREA_SIZE), &chain->addr[i + 1], sizeof(uint32_t));
+        }
+    }
+    *link = chain->addr[index - chain->base + 1];
+    return chain->addr[index - chain->base];
+}
+
+/**
+ * @brief 沿链表指针废弃连续count个扇区, 标记为SECTOR_DISCARD_FLAG并加入可擦除FTL表
+ * @param addr 首扇区首地址
+ * @param count 扇区数量, 为0时不操作
+ * */
+static void ICACHE_FLASH_ATTR cow_discard(spifs_t *fs, uint32_t addr, uint32_t count) {
+    uint32_t next;
+
+    while(count > 0) {
+        spifs_flash_read(fs, (addr + SECTOR_MARK_SIZE + DATA_AREA_SIZE), &next, sizeof(uint32_t));
+        spifs_ftl_mark(fs, &fs->ftl_erasable, (addr / SECTOR_SIZE), FTL_MARK);
+        update_sector_mark(fs, addr, sector_mark(fs, addr, SECTOR_DISCARD_FLAG));
+        addr = next;
+        count--;
+    }
+}
+
+/**
+ * @brief 页写入暂存: 将写入数据合并到页缓冲区, 离开当前页时整页一次编程
+ * @brief 写入地址和长度无需4字节对齐, 页内未写入部分保持0xFF, 不影响flash已有数据
+ * @param *stage 页暂存区
  * @param *buffer 可由malloc或者静态分配
  * @param offset buffer中的读取偏移量(读出buffer->写入)
  * @param write_addr 写入flash的地址，随机地址
  * @param write_size 写入flash的数据长度
  */
-static void align_write_impl(uint8_t *buffer, uint32_t offset, uint32_t write_addr, uint32_t write_size) {
-    size_t addr_align;
-    uint32_t data_align, temp, towrite;
-
-	// (buffer + offset)对齐处理，判断写入地址是否在平台指针边界
-    addr_align = ((size_t)(buffer + offset)) & (sizeof(size_t) - 1);
-	if(addr_align != 0) {
-		// 当前(buffer + offset)不对齐，写出不对齐部分，随后(buffer + offset)对齐到4字节边界
-		temp = EMPTY_INT_VALUE;
-		towrite = ((sizeof(size_t) - addr_align) < write_size) ? (sizeof(size_t) - addr_align) : write_size;
-        os_memcpy(&temp, (buffer + offset), towrite);
-		spi_flash_write(write_addr, &temp, sizeof(uint32_t));
-
-		write_addr += towrite;
-		offset += towrite;
-		write_size -= towrite;
-	}
+static void ICACHE_FLASH_ATTR stage_write(spifs_t *fs, PageStage *stage, uint8_t *buffer, uint32_t offset, uint32_t write_addr, uint32_t write_size) {
+    uint32_t page, pos, towrite;
+
+    while(write_size > 0) {
+        page = write_addr & ~(PAGE_SIZE - 1);
+        if(stage->page != page) {
+            stage_flush(fs, stage);
+            stage->page = page;
+            os_memset(stage->buffer, EMPTY_BYTE_VALUE, PAGE_SIZE);
+        }
+        pos = (write_addr - page);
+        towrite = ((PAGE_SIZE - pos) < write_size) ? (PAGE_SIZE - pos) : write_size;
+        os_memcpy(((uint8_t *)stage->buffer + pos), (buffer + offset), towrite);
+        stage->low = (pos < stage->low) ? pos : stage->low;
+        stage->high = ((pos + towrite) > stage->high) ? (pos + towrite) : stage->high;
+
+        write_addr += towrite;
+        offset += towrite;
+        write_size -= towrite;
+    }
+}
 
-    if(write_size == 0) {
-        return;
+/**
+ * @brief 编程暂存页中已写入的部分, 范围扩展到4字节边界
+ * @param *stage 页暂存区
+ */
+static void ICACHE_FLASH_ATTR stage_flush(spifs_t *fs, PageStage *stage) {
+    uint32_t low, high;
+
+    if(stage->page != EMPTY_INT_VALUE && stage->high > stage->low) {
+        low = stage->low & ~(sizeof(uint32_t) - 1);
+        high = (stage->high + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+        spifs_flash_write(fs, (stage->page + low), (stage->buffer + (low / sizeof(uint32_t))), (high - low));
+    }
+    stage->page = EMPTY_INT_VALUE;
+    stage->low = PAGE_SIZE;
+    stage->high = 0;
+}
+
+/**
+ * @brief 页写入暂存, 数据依次取自分散缓冲区各段, 段边界不影响页合并
+ * @param *src 数据段游标, 返回时移至已写入数据之后
+ * @param write_addr 写入flash的地址，随机地址
+ * @param write_size 写入flash的数据长度
+ */
+static void ICACHE_FLASH_ATTR stage_write_iov(spifs_t *fs, PageStage *stage, IovCursor *src, uint32_t write_addr, uint32_t write_size) {
+    uint32_t size;
+
+    while(write_size > 0) {
+        size = (src->iov->length - src->offset);
+        if(size == 0) {
+            src->iov++;
+            src->offset = 0;
+            continue;
+        }
+        size = (size < write_size) ? size : write_size;
+        stage_write(fs, stage, src->iov->base, src->offset, write_addr, size);
+        src->offset += size;
+        write_addr += size;
+        write_size -= size;
     }
-	// 写入地址+写入大小是否在4字节边界
-	// 由于(uint32_t)(buffer + offset)已判断过对齐，此处仅需判断write_size是否对齐
-	if((data_align = (write_size % sizeof(uint32_t))) == 0) {
-		// (buffer + offset)对齐，且write_size对齐，直接写入
-		spi_flash_write(write_addr, (uint32_t *)(buffer + offset), write_size);
-	}else {
-		// (buffer + offset)对齐，但write_size不对齐
-		// 将对齐部分写入
-		if(write_size > data_align) {
-			temp = (write_size - data_align);
-			spi_flash_write(write_addr, (uint32_t *)(buffer + offset), temp);
-			offset += temp;
-			write_addr += temp;
-		}
-		// 填充剩余不足四字节部分
-		temp = EMPTY_INT_VALUE;
-		os_memcpy(&temp, (buffer + offset), data_align);
-		spi_flash_write(write_addr, &temp, sizeof(uint32_t));
-	}
 }
 
 /**
@@ -342,7 +941,17 @@ static void align_write_impl(uint8_t *buffer, uint32_t offset, uint32_t write_ad
  * @param *file 文件指针
  * @return Result
  * */
-Result ICACHE_FLASH_ATTR write_finish(File *file) {
+Result ICACHE_FLASH_ATTR write_finish(spifs_t *fs, File *file) {
+    API_ENTER(SPIFS_API_WRITE_FINISH, API_LOCK_WRITE);
+    return API_RETURN(write_finish_impl(fs, file));
+}
+
+/**
+ * @brief 追加写结束实现
+ * @param *file 文件指针
+ * @return Result
+ * */
+static Result ICACHE_FLASH_ATTR write_finish_impl(spifs_t *fs, File *file) {
     FileBlock fblock;
     FileInfo finfo;
     Result result;
@@ -352,18 +961,18 @@ Result ICACHE_FLASH_ATTR write_finish(File *file) {
     }
 #endif
     // 读取原始文件索引块
-    spi_flash_read(file->block, (uint32_t *)&fblock, sizeof(fblock));
+    spifs_flash_read(fs, file->block, (uint32_t *)&fblock, sizeof(fblock));
     if(fblock.length == EMPTY_INT_VALUE) {
         // 文件大小信息为空，直接写入文件大小信息
-        write_fileblock_length(file->block, file->length);
+        write_fileblock_length(fs, file->block, file->length);
         return APPEND_FILE_FINISH;
     }
     //读取文件属性
-    read_finfo(file, &finfo);
+    read_finfo_impl(fs, file, &finfo);
     // 标记旧的文件索引块失效，但不执行擦除操作
-    write_fileblock_state(file->block, FSTATE_DEPRECATE);
+    fileblock_retire(fs, file, FSTATE_DEPRECATE);
     // 重新创建文件索引块
-    result = create_file(file, &finfo);
+    result = create_file_impl(fs, file, &finfo);
     return (result == CREATE_FILE_SUCCESS) ? APPEND_FILE_FINISH : result;
 }
 
@@ -375,105 +984,242 @@ Result ICACHE_FLASH_ATTR write_finish(File *file) {
  * @param length 读出字节数
  * @return length 实际读取的大小(bytes),正确返回时该值大于0
  * */
-uint32_t ICACHE_FLASH_ATTR read_file(File *file, uint32_t offset, uint8_t *buffer, uint32_t length) {
+uint32_t ICACHE_FLASH_ATTR read_file(spifs_t *fs, File *file, uint32_t offset, uint8_t *buffer, uint32_t length) {
     FileInfo finfo;
-    uint32_t addr_start = file->cluster, cursor = 0;
-    uint32_t sectors = (offset / DATA_AREA_SIZE);
-    uint32_t i, read_size, temp;
+    SpifsIovec seg;
+    API_ENTER(SPIFS_API_READ_FILE, API_LOCK_READ);
 #ifdef SPIFS_USE_NULL_CHECK
     // 空指针检查
     if(file == NULL || (file->block & file->cluster & file->length) == EMPTY_INT_VALUE) {
-        return 0;
+        return API_RETURN(0);
     }
 #endif
-    read_finfo(file, &finfo);
+    read_finfo_impl(fs, file, &finfo);
     // 权限检查
     if(!(finfo.state.del & finfo.state.dep)) {
-        return 0;
-    }
-    // 边界检查
-    if(offset >= file->length) {
-        return 0;
-    }
-
-    if((file->length - offset) < length) {
-    	length = (file->length - offset);
+        return API_RETURN(0);
     }
+    seg.base = buffer;
+    seg.length = length;
+    return API_RETURN(read_file_impl(fs, file, NULL, offset, &seg, length, NULL, NULL));
+}
 
-    // 跳过偏移扇区
-    for(i = 0; i < sectors; i++) {
-        spi_flash_read((addr_start + SECTOR_MARK_SIZE + DATA_AREA_SIZE), &temp, sizeof(uint32_t));
-        addr_start = temp;
-        offset -= DATA_AREA_SIZE;
+/**
+ * @brief 分散读文件, 从offset开始依次填满各段, 效果等同于读入连续缓冲区后拆分
+ * @param *file 文件指针
+ * @param offset 文件偏移量, 以0为基准
+ * @param *iov 数据段数组
+ * @param iovcnt 数据段数量
+ * @return 实际读取的大小(bytes), 到达文件末尾时小于各段长度之和
+ * */
+uint32_t ICACHE_FLASH_ATTR read_file_v(spifs_t *fs, File *file, uint32_t offset, const SpifsIovec *iov, uint32_t iovcnt) {
+    FileInfo finfo;
+    uint32_t i, length = 0;
+    API_ENTER(SPIFS_API_READ_FILE, API_LOCK_READ);
+#ifdef SPIFS_USE_NULL_CHECK
+    if(file == NULL || iov == NULL || (file->block & file->cluster & file->length) == EMPTY_INT_VALUE) {
+        return API_RETURN(0);
+    }
+#endif
+    for(i = 0; i < iovcnt; i++) {
+#ifdef SPIFS_USE_NULL_CHECK
+        if(iov[i].base == NULL && iov[i].length > 0) {
+            return API_RETURN(0);
+        }
+#endif
+        length += iov[i].length;
+    }
+    read_finfo_impl(fs, file, &finfo);
+    // 权限检查
+    if(!(finfo.state.del & finfo.state.dep)) {
+        return API_RETURN(0);
+    }
+    return API_RETURN(read_file_impl(fs, file, NULL, offset, iov, length, NULL, NULL));
+}
+
+#ifdef SPIFS_USE_MMAP
+/**
+ * @brief 以内存映射方式访问文件数据, 返回各扇区内的只读数据段, 不复制数据, 扇区链表指针从映射区读出
+ * @brief 数据段在文件被修改/删除或垃圾回收前有效; XIP平台写入flash后需由移植层使映射缓存失效
+ * @param *file 文件指针
+ * @param offset 文件偏移量, 以0为基准
+ * @param length 映射字节数
+ * @param *span 输出数据段数组
+ * @param max 数据段数组长度, 映射范围跨越扇区数较多时可从最后一段末尾继续调用
+ * @return 输出的数据段数量, 0:未配置映射基址/超出文件末尾
+ * */
+uint32_t ICACHE_FLASH_ATTR map_file(spifs_t *fs, File *file, uint32_t offset, uint32_t length, SpifsSpan *span, uint32_t max) {
+    FileInfo finfo;
+    uint32_t addr, size, count = 0;
+    API_ENTER(SPIFS_API_MAP_FILE, API_LOCK_READ);
+#ifdef SPIFS_USE_NULL_CHECK
+    if(file == NULL || span == NULL || (file->block & file->cluster & file->length) == EMPTY_INT_VALUE) {
+        return API_RETURN(0);
+    }
+#endif
+    if(fs->mmap_base == NULL || offset >= file->length || length == 0 || max == 0) {
+        return API_RETURN(0);
+    }
+    read_finfo_impl(fs, file, &finfo);
+    // 权限检查
+    if(!(finfo.state.del & finfo.state.dep)) {
+        return API_RETURN(0);
+    }
+    if((file->length - offset) < length) {
+        length = (file->length - offset);
+    }
+
+    addr = cluster_seek(fs, file, NULL, (offset / DATA_AREA_SIZE));
+    offset %= DATA_AREA_SIZE;
+    for(;;) {
+        size = (DATA_AREA_SIZE - offset);
+        size = (length < size) ? length : size;
+        span[count].data = (fs->mmap_base + addr + SECTOR_MARK_SIZE + offset);
+        span[count].length = size;
+        count++;
+        length -= size;
+        if(length == 0 || count >= max) {
+            break;
+        }
+        os_memcpy(&addr, (fs->mmap_base + addr + SECTOR_MARK_SIZE + DATA_AREA_SIZE), sizeof(uint32_t));
+        offset = 0;
+    }
+    return API_RETURN(count);
+}
+#endif
+
+/**
+ * @brief 读取文件实现, 调用者完成权限检查
+ * @param *file 文件指针
+ * @param *cache 簇链缓存, 可为NULL
+ * @param offset 文件偏移量
+ * @param *iov 存储数据段数组, 各段长度之和不小于length
+ * @param length 读出字节数
+ * @param *sec_index 扇区游标序号, 可为NULL; 与*sec_addr配合, 目标扇区不在游标之前时从游标处继续遍历簇链
+ * @param *sec_addr 扇区游标首地址, 返回时更新为最后读取字节所在扇区
+ * @return 实际读取的大小(bytes)
+ * */
+static uint32_t ICACHE_FLASH_ATTR read_file_impl(spifs_t *fs, File *file, ClusterCache *cache, uint32_t offset, const SpifsIovec *iov, uint32_t length, uint32_t *sec_index, uint32_t *sec_addr) {
+    uint32_t addr_start;
+    uint32_t sectors = (offset / DATA_AREA_SIZE);
+    uint32_t i, read_size, temp;
+    IovCursor dst;
+
+    // 边界检查
+    if(offset >= file->length || length == 0) {
+        return 0;
+    }
+
+    if((file->length - offset) < length) {
+    	length = (file->length - offset);
+    }
+
+    // 跳过偏移扇区, 游标有效且不在目标扇区之后时从游标继续
+    if(sec_index != NULL && *sec_addr != EMPTY_INT_VALUE && *sec_index <= sectors) {
+        addr_start = *sec_addr;
+        for(i = *sec_index; i < sectors; i++) {
+            spifs_flash_read(fs, (addr_start + SECTOR_MARK_SIZE + DATA_AREA_SIZE), &addr_start, sizeof(uint32_t));
+        }
+    }else {
+        addr_start = cluster_seek(fs, file, cache, sectors);
+    }
+    offset -= (sectors * DATA_AREA_SIZE);
+    if(sec_index != NULL) {
+        // 记录最后读取字节所在扇区, 跨扇区时*sec_addr在读取过程中更新
+        *sec_index = (sectors + (offset + length - 1) / DATA_AREA_SIZE);
+        *sec_addr = addr_start;
     }
     i = length;
+    dst.iov = iov;
+    dst.offset = 0;
     // 移至当前扇区偏移地址
     addr_start += (SECTOR_MARK_SIZE + offset);
     read_size = (DATA_AREA_SIZE - offset);
 
     while(length > 0) {
     	if(length > read_size) {
-    		align_read_impl(buffer, cursor, addr_start, read_size);
-    		addr_start += read_size;
-    		cursor += read_size;
+    		// 读至扇区末尾, 链表指针与数据同一次读出
+    		temp = burst_read_iov(fs, &dst, addr_start, read_size, TRUE);
     		length -= read_size;
 
-    		spi_flash_read(addr_start, &temp, sizeof(uint32_t));
     		addr_start = (temp + SECTOR_MARK_SIZE);
-    		read_size = (length > DATA_AREA_SIZE) ? DATA_AREA_SIZE : (length);
+    		if(sec_addr != NULL) {
+    			*sec_addr = temp;
+    		}
+    		read_size = DATA_AREA_SIZE;
     	}else {
-    	    read_size = (length > DATA_AREA_SIZE) ? DATA_AREA_SIZE : (length);
-    		align_read_impl(buffer, cursor, addr_start, read_size);
-    		length -= read_size;
+    		burst_read_iov(fs, &dst, addr_start, length, FALSE);
+    		length = 0;
     	}
     }
     return i;
 }
 
 /**
- * @param *buffer 可由malloc或者静态分配
- * @param offset buffer中的写入偏移量(读取->写入buffer)
- * @param write_addr 写入flash的地址，随机地址
- * @param write_size 写入flash的数据长度
+ * @brief 连续flash区间突发读, 地址/长度/缓冲区均无需4字节对齐
+ * @brief 长度不超过READ_BOUNCE_SIZE时经对齐中转缓冲区一次读出
+ * @brief 否则对齐部分直接读入buffer后整体前移, 剩余不足4字节部分与链表指针经中转缓冲区读出, 共两次读操作
+ * @param *buffer 读出数据缓冲区
+ * @param read_addr flash地址, 随机地址
+ * @param read_size 读取长度
+ * @param link TRUE: 一并读出紧随数据之后的下一扇区指针
+ * @return 下一扇区首地址, link为FALSE时返回EMPTY_INT_VALUE
  */
-static void align_read_impl(uint8_t *buffer, uint32_t offset, uint32_t read_addr, uint32_t read_size) {
-    uint32_t data_align, temp, toread;
-    size_t addr_align;
-
-	// (buffer + offset)对齐处理，判断读入缓存地址是否在平台指针边界
-	addr_align = ((size_t)(buffer + offset)) & (sizeof(size_t) - 1);
-
-	if(addr_align != 0) {
-		// 当前(buffer + offset)不对齐，读取不对齐部分填充，随后(buffer + offset)对齐到4字节边界
-		spi_flash_read(read_addr, &temp, sizeof(uint32_t));
-		toread = ((sizeof(size_t) - addr_align) < read_size) ? (sizeof(size_t) - addr_align) : read_size;
-		os_memcpy((buffer + offset), &temp, toread);
-
-		offset += toread;
-		read_addr += toread;
-		read_size -= toread;
-	}
+static uint32_t ICACHE_FLASH_ATTR burst_read(spifs_t *fs, uint8_t *buffer, uint32_t read_addr, uint32_t read_size, BOOL link) {
+    uint32_t bounce[READ_BOUNCE_SIZE / sizeof(uint32_t) + 2];
+    uint32_t head, tail, bulk, skip, next = EMPTY_INT_VALUE;
+    uint8_t *aligned;
+
+    tail = read_addr + read_size + (link ? sizeof(uint32_t) : 0);
+    head = read_addr & ~(sizeof(uint32_t) - 1);
+    if(read_size > READ_BOUNCE_SIZE) {
+        // buffer内第一个4字节边界, 对齐部分按flash地址对齐读入
+        skip = ((sizeof(uint32_t) - ((size_t)buffer & (sizeof(uint32_t) - 1))) & (sizeof(uint32_t) - 1));
+        aligned = (buffer + skip);
+        bulk = (read_size - skip) & ~(sizeof(uint32_t) - 1);
+        spifs_flash_read(fs, head, (uint32_t *)aligned, bulk);
+        // 前移到buffer起始位置
+        os_memmove(buffer, (aligned + (read_addr - head)), (bulk - (read_addr - head)));
+        buffer += (bulk - (read_addr - head));
+        read_size -= (bulk - (read_addr - head));
+        read_addr = head + bulk;
+        head = read_addr;
+    }
+    // 剩余部分(含链表指针)经中转缓冲区读出
+    bulk = ((tail - head) + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+    spifs_flash_read(fs, head, bounce, bulk);
+    os_memcpy(buffer, ((uint8_t *)bounce + (read_addr - head)), read_size);
+    if(link) {
+        os_memcpy(&next, ((uint8_t *)bounce + (read_addr - head) + read_size), sizeof(uint32_t));
+    }
+    return next;
+}
 
-    if(read_size == 0) {
-        return;
+/**
+ * @brief 连续flash区间突发读到分散缓冲区, 每段一次突发读, 链表指针随最后一段读出
+ * @param *dst 数据段游标, 返回时移至已读出数据之后
+ * @param read_addr flash地址, 随机地址
+ * @param read_size 读取长度
+ * @param link TRUE: 一并读出紧随数据之后的下一扇区指针
+ * @return 下一扇区首地址, link为FALSE时返回EMPTY_INT_VALUE
+ */
+static uint32_t ICACHE_FLASH_ATTR burst_read_iov(spifs_t *fs, IovCursor *dst, uint32_t read_addr, uint32_t read_size, BOOL link) {
+    uint32_t size, next = EMPTY_INT_VALUE;
+
+    while(read_size > 0) {
+        size = (dst->iov->length - dst->offset);
+        if(size == 0) {
+            dst->iov++;
+            dst->offset = 0;
+            continue;
+        }
+        size = (size < read_size) ? size : read_size;
+        next = burst_read(fs, (dst->iov->base + dst->offset), read_addr, size, (link && (size == read_size)));
+        dst->offset += size;
+        read_addr += size;
+        read_size -= size;
     }
-	// 由于(uint32_t)(buffer + offset)已判断过对齐，此处仅需判断read_size是否4字节对齐
-	if((data_align = (read_size % sizeof(uint32_t))) == 0) {
-		// (buffer + offset)对齐，且read_size对齐，直接读取
-		spi_flash_read(read_addr, (uint32_t *)(buffer + offset), read_size);
-	}else {
-		// (buffer + offset)对齐，但read_size不对齐
-		// 将对齐部分读入
-		if(read_size > data_align) {
-			temp = (read_size - data_align);
-			spi_flash_read(read_addr, (uint32_t *)(buffer + offset), temp);
-			offset += temp;
-			read_addr += temp;
-		}
-		// 读取剩余不足四字节部分
-		spi_flash_read(read_addr, &temp, sizeof(uint32_t));
-		os_memcpy((buffer + offset), &temp, data_align);
-	}
+    return next;
 }
 
 /**
@@ -483,32 +1229,36 @@ static void align_read_impl(uint8_t *buffer, uint32_t offset, uint32_t read_addr
  * @param extname 拓展名 没有名字可以传入空字符串 ""
  * @return 0:未找到该文件, 1:成功获取文件
  * */
-BOOL ICACHE_FLASH_ATTR open_file(File *file, char *filename, char *extname) {
-    return open_file_impl(file, (uint8_t *)filename, (uint8_t *)extname, FALSE);
+BOOL ICACHE_FLASH_ATTR open_file(spifs_t *fs, File *file, char *filename, char *extname) {
+    API_ENTER(SPIFS_API_OPEN_FILE, API_LOCK_READ);
+    return API_RETURN(open_file_impl(fs, file, (uint8_t *)filename, (uint8_t *)extname, FALSE));
 }
 
 /**
  * @brief 根据文件名+拓展名打开文件，文件名空缺部分以0xFF填充
  * */
-BOOL ICACHE_FLASH_ATTR open_file_raw(File *file, uint8_t *filename, uint8_t *extname) {
-    return open_file_impl(file, filename, extname, TRUE);
+BOOL ICACHE_FLASH_ATTR open_file_raw(spifs_t *fs, File *file, uint8_t *filename, uint8_t *extname) {
+    API_ENTER(SPIFS_API_OPEN_FILE, API_LOCK_READ);
+    return API_RETURN(open_file_impl(fs, file, filename, extname, TRUE));
 }
 
 /**
  * @brief 打开文件实现
+ * @brief 文件块RAM索引未建立(延迟挂载或未启用)时逐扇区扫描, 每次突发读取不超过FB_SCAN_SLOTS个文件块到栈上窗口
  * @param *file 文件指针
  * @param filename 文件名
  * @param extname 拓展名
  * @param rawname 原始格式文件名，原始格式空缺填充0xFF
  * @return 0:未找到该文件, 1:成功获取文件
  * */
-static BOOL ICACHE_FLASH_ATTR open_file_impl(File *file, uint8_t *filename, uint8_t *extname, BOOL rawname) {
+static BOOL ICACHE_FLASH_ATTR open_file_impl(spifs_t *fs, File *file, uint8_t *filename, uint8_t *extname, BOOL rawname) {
     FileBlock *fb;
-    uint32_t addr_start, addr_end, i;
+    uint32_t addr_start, slot, end, i, n;
     // 栈上分配保证4字节对齐，允许强制转换成(uint32_t *)
-    uint8_t slot_buffer[FILEBLOCK_SIZE];
-    // 全部转换成原始文件名
-    uint8_t tempFileName[FILENAME_SIZE], tempExtName[EXTNAME_SIZE];
+    uint32_t window[FB_SCAN_SLOTS * FILEBLOCK_SIZE / sizeof(uint32_t)];
+    // 全部转换成原始文件名, 文件名与拓展名连续存放
+    uint8_t tempName[FILENAME_FULLSIZE];
+    uint8_t *tempFileName = tempName, *tempExtName = (tempName + FILENAME_SIZE);
 
     if(rawname) {
     	os_memcpy(tempFileName, filename, FILENAME_SIZE);
@@ -522,41 +1272,57 @@ static BOOL ICACHE_FLASH_ATTR open_file_impl(File *file, uint8_t *filename, uint
     	os_memcpy(tempExtName, extname, i);
     }
 
-    for(i = FB_SECTOR_START; i < (FB_SECTOR_END + 1); i++) {
-
-        addr_start = i * SECTOR_SIZE;
-        addr_end = (addr_start + SECTOR_SIZE);
+#ifdef SPIFS_USE_FB_INDEX
+    if(fb_index_ready(fs)) {
+        fb = (FileBlock *)window;
+        addr_start = fb_index_lookup(fs, tempName, fb);
+        if(addr_start == EMPTY_INT_VALUE) {
+            return FALSE;
+        }
+        file->block = addr_start;
+        file->cluster = fb->cluster;
+        file->length = fb->length;
+        os_memcpy(file->filename, fb->filename, FILENAME_SIZE);
+        os_memcpy(file->extname, fb->extname, EXTNAME_SIZE);
+        return TRUE;
+    }
+#endif
 
-        while((addr_end - addr_start) >= FILEBLOCK_SIZE) {
-            spi_flash_read(addr_start, (uint32_t *)slot_buffer, FILEBLOCK_SIZE);
-            fb = (FileBlock *)slot_buffer;
+    for(slot = 0; slot < fs->fb_slots; ) {
+        // 窗口不跨越文件索引扇区
+        end = ((slot / FB_SLOTS_PER_SECTOR + 1) * FB_SLOTS_PER_SECTOR);
+        end = (end < fs->fb_slots) ? end : fs->fb_slots;
+        n = ((end - slot) < FB_SCAN_SLOTS) ? (end - slot) : FB_SCAN_SLOTS;
+        spifs_flash_read(fs, fb_slot_addr(fs, slot), window, (n * FILEBLOCK_SIZE));
+        for(i = 0; i < n; i++, slot++) {
+            fb = (FileBlock *)((uint8_t *)window + i * FILEBLOCK_SIZE);
             // 忽略标记删除/废弃的文件
             if(!(fb->info.state.del & fb->info.state.dep)) {
-            	addr_start += FILEBLOCK_SIZE;
-				continue;
+                continue;
             }
             // 检查文件名与拓展名
             if(filename_equals(fb->filename, tempFileName, FILENAME_SIZE) && filename_equals(fb->extname, tempExtName, EXTNAME_SIZE)) {
-                file->block = addr_start;
+                file->block = fb_slot_addr(fs, slot);
                 file->cluster = fb->cluster;
                 file->length = fb->length;
                 os_memcpy(file->filename, fb->filename, FILENAME_SIZE);
                 os_memcpy(file->extname, fb->extname, EXTNAME_SIZE);
                 return TRUE;
             }
-            addr_start += FILEBLOCK_SIZE;
         }
     }
     return FALSE;
 }
 
-Result ICACHE_FLASH_ATTR rename_file(File *file, char *filename, char *extname) {
-	return rename_file_impl(file, (uint8_t *)filename, (uint8_t *)extname, FALSE);
+Result ICACHE_FLASH_ATTR rename_file(spifs_t *fs, File *file, char *filename, char *extname) {
+	API_ENTER(SPIFS_API_RENAME_FILE, API_LOCK_WRITE);
+	return API_RETURN(rename_file_impl(fs, file, (uint8_t *)filename, (uint8_t *)extname, FALSE));
 }
 
 
-Result ICACHE_FLASH_ATTR rename_file_raw(File *file, uint8_t *filename, uint8_t *extname) {
-	return rename_file_impl(file, filename, extname, TRUE);
+Result ICACHE_FLASH_ATTR rename_file_raw(spifs_t *fs, File *file, uint8_t *filename, uint8_t *extname) {
+	API_ENTER(SPIFS_API_RENAME_FILE, API_LOCK_WRITE);
+	return API_RETURN(rename_file_impl(fs, file, filename, extname, TRUE));
 }
 /**
  * @brief 重命名文件
@@ -565,7 +1331,7 @@ Result ICACHE_FLASH_ATTR rename_file_raw(File *file, uint8_t *filename, uint8_t
  * @param *extname 拓展名
  * @return Result 成功: FILE_RENAME_SUCCESS, 其他结果码见Result定义
  */
-static Result ICACHE_FLASH_ATTR rename_file_impl(File *file, uint8_t *filename, uint8_t *extname, BOOL raw) {
+static Result ICACHE_FLASH_ATTR rename_file_impl(spifs_t *fs, File *file, uint8_t *filename, uint8_t *extname, BOOL raw) {
     FileInfo fileinfo;
     uint32_t fnamelen, extnamelen;
 
@@ -575,7 +1341,7 @@ static Result ICACHE_FLASH_ATTR rename_file_impl(File *file, uint8_t *filename,
     }
 #endif
     // 读出文件状态字
-    read_finfo(file, &fileinfo);
+    read_finfo_impl(fs, file, &fileinfo);
     // 文件状态检查
     if(fileinfo.state.del & fileinfo.state.dep & fileinfo.state.rw) {
     	if(raw) {
@@ -589,9 +1355,9 @@ static Result ICACHE_FLASH_ATTR rename_file_impl(File *file, uint8_t *filename,
         if(fnamelen > FILENAME_SIZE || extnamelen > EXTNAME_SIZE) {
             return FILENAME_OUT_OF_BOUNDS;
         }
-        if(spifs_avail_files() > 0) {
+        if(avail_files_impl(fs) > 0) {
             // 标记文件索引表原始文件对应文件块失效，但不执行擦除操作
-            write_fileblock_state(file->block, FSTATE_DEPRECATE);
+            fileblock_retire(fs, file, FSTATE_DEPRECATE);
             // 清空原文件名
 			os_memset((file->filename), EMPTY_BYTE_VALUE, FILENAME_SIZE);
 			os_memset((file->extname), EMPTY_BYTE_VALUE, EXTNAME_SIZE);
@@ -599,7 +1365,7 @@ static Result ICACHE_FLASH_ATTR rename_file_impl(File *file, uint8_t *filename,
 			os_memcpy(file->filename, filename, fnamelen);
 			os_memcpy(file->extname, extname, extnamelen);
             // 重新创建文件索引块
-            return (CREATE_FILE_SUCCESS == create_file(file, &fileinfo)) ? FILE_RENAME_SUCCESS : NO_FILEBLOCK_SPACE;
+            return (CREATE_FILE_SUCCESS == create_file_impl(fs, file, &fileinfo)) ? FILE_RENAME_SUCCESS : NO_FILEBLOCK_SPACE;
         }
         return NO_FILEBLOCK_SPACE;
     }
@@ -612,21 +1378,22 @@ static Result ICACHE_FLASH_ATTR rename_file_impl(File *file, uint8_t *filename,
  * @param *startAddr 用于接收下一次list_file的起始地址(FB_SECTOR物理地址)，第一次调用传入FB_SECTOR_START*4096
  * @return count 实际查找到的文件数量(count <= max)
  * */
-uint32_t ICACHE_FLASH_ATTR list_file(uint32_t *startAddr, File *files, uint32_t max) {
+uint32_t ICACHE_FLASH_ATTR list_file(spifs_t *fs, uint32_t *startAddr, File *files, uint32_t max) {
 	uint32_t addr_start, addr_end, count = 0;
 	FileBlock *fb;
 	uint8_t fileblock[FILEBLOCK_SIZE];
 	uint32_t sector = ((*startAddr) / SECTOR_SIZE);
+	API_ENTER(SPIFS_API_LIST_FILE, API_LOCK_READ);
 
 	addr_start = (*startAddr);
 	addr_end = (sector * SECTOR_SIZE + SECTOR_SIZE);
 
-	while((sector < (FB_SECTOR_END + 1)) && (count < max)) {
+	while((sector < (fs->fb_end + 1)) && (count < max)) {
 
 		// addr_end不减1，(addr_end - addr_start)也不需要+1
 		while((addr_end - addr_start) >= FILEBLOCK_SIZE) {
 
-			spi_flash_read(addr_start, (uint32_t *)fileblock, FILEBLOCK_SIZE);
+			spifs_flash_read(fs, addr_start, (uint32_t *)fileblock, FILEBLOCK_SIZE);
 			fb = (FileBlock *)fileblock;
 
 			if((fb->info.state.del & fb->info.state.dep) && (fb->cluster != EMPTY_INT_VALUE)) {
@@ -648,7 +1415,7 @@ uint32_t ICACHE_FLASH_ATTR list_file(uint32_t *startAddr, File *files, uint32_t
 					// 切换到下一扇区首地址
 					sector++;
 					// startAddr地址限制在FB_SECTOR_END扇区内
-					*startAddr = (sector < (FB_SECTOR_END + 1)) ? (sector * SECTOR_SIZE) : (FB_SECTOR_START * SECTOR_SIZE);
+					*startAddr = (sector < (fs->fb_end + 1)) ? (sector * SECTOR_SIZE) : (fs->fb_start * SECTOR_SIZE);
 				}
 				break;
 			}
@@ -658,7 +1425,7 @@ uint32_t ICACHE_FLASH_ATTR list_file(uint32_t *startAddr, File *files, uint32_t
 		addr_start = (sector * SECTOR_SIZE);
 		addr_end = (addr_start + SECTOR_SIZE);
 	}
-	return count;
+	return API_RETURN(count);
 }
 
 /**
@@ -668,21 +1435,22 @@ uint32_t ICACHE_FLASH_ATTR list_file(uint32_t *startAddr, File *files, uint32_t
  * @param max 最大获取的数量
  * @return 实际获取的数量，startAddr指向的内存会被修改返回
  * */
-uint32_t ICACHE_FLASH_ATTR list_file_raw(uint32_t *startAddr, uint8_t *buffer, uint32_t max) {
+uint32_t ICACHE_FLASH_ATTR list_file_raw(spifs_t *fs, uint32_t *startAddr, uint8_t *buffer, uint32_t max) {
 	uint32_t addr_start, addr_end, count = 0;
     FileBlock *fb;
     uint8_t fileblock[FILEBLOCK_SIZE];
 	uint32_t sector = ((*startAddr) / SECTOR_SIZE);
+	API_ENTER(SPIFS_API_LIST_FILE, API_LOCK_READ);
 
 	addr_start = (*startAddr);
 	addr_end = (sector * SECTOR_SIZE + SECTOR_SIZE);
 
-	while((sector < (FB_SECTOR_END + 1)) && (count < max)) {
+	while((sector < (fs->fb_end + 1)) && (count < max)) {
 
 		// addr_end不减1，(addr_end - addr_start)也不需要+1
 		while((addr_end - addr_start) >= FILEBLOCK_SIZE) {
 
-			spi_flash_read(addr_start, (uint32_t *)fileblock, FILEBLOCK_SIZE);
+			spifs_flash_read(fs, addr_start, (uint32_t *)fileblock, FILEBLOCK_SIZE);
 			fb = (FileBlock *)fileblock;
 
 			if((fb->info.state.del & fb->info.state.dep) && (fb->cluster != EMPTY_INT_VALUE) && (fb->length != EMPTY_INT_VALUE)) {
@@ -709,7 +1477,7 @@ uint32_t ICACHE_FLASH_ATTR list_file_raw(uint32_t *startAddr, uint8_t *buffer, u
 					// 切换到下一扇区首地址
 					sector++;
 					// startAddr地址限制在FB_SECTOR_END扇区内
-					*startAddr = (sector < (FB_SECTOR_END + 1)) ? (sector * SECTOR_SIZE) : (FB_SECTOR_START * SECTOR_SIZE);
+					*startAddr = (sector < (fs->fb_end + 1)) ? (sector * SECTOR_SIZE) : (fs->fb_start * SECTOR_SIZE);
 				}
 				break;
 			}
@@ -719,7 +1487,127 @@ uint32_t ICACHE_FLASH_ATTR list_file_raw(uint32_t *startAddr, uint8_t *buffer, u
 		addr_start = (sector * SECTOR_SIZE);
 		addr_end = (addr_start + SECTOR_SIZE);
 	}
-	return count;
+	return API_RETURN(count);
+}
+
+/**
+ * @brief 初始化文件列表过滤条件为不限制
+ * */
+void ICACHE_FLASH_ATTR list_filter_init(SpifsListFilter *filter) {
+	filter->extname = NULL;
+	filter->prefix = NULL;
+	filter->fstate = FSTATE_DEFAULT;
+	filter->min_length = 0;
+	filter->max_length = 0;
+}
+
+/**
+ * @brief 按条件分页获取文件列表, 从游标位置起每次突发读取不超过FB_SCAN_SLOTS个文件块到栈上窗口, 不分配内存
+ * @brief 启用槽位状态表时跳过无有效文件块的槽位, 逐页调用完成一次完整遍历
+ * @param *cursor 游标, 首次调用设为SPIFS_LIST_BEGIN, 返回时指向下一次查找的位置, 全部列出后为SPIFS_LIST_END
+ * @param *filter 过滤条件, NULL:列出全部有效文件
+ * @param *files 用于存储查找到的文件
+ * @param *finfos 用于存储对应的文件信息, 可为NULL
+ * @param max files/finfos的最大容量
+ * @return 实际查找到的文件数量(count <= max), 返回0且游标不为SPIFS_LIST_END时表示参数无效
+ * */
+uint32_t ICACHE_FLASH_ATTR list_file_filter(spifs_t *fs, SpifsListCursor *cursor, const SpifsListFilter *filter, File *files, FileInfo *finfos, uint32_t max) {
+	uint32_t window[FB_SCAN_SLOTS * FILEBLOCK_SIZE / sizeof(uint32_t)];
+	FileBlock *fb;
+	uint32_t slot, end, i, n, count = 0;
+#ifdef SPIFS_USE_FB_SLOTMAP
+	uint32_t live;
+#endif
+	API_ENTER(SPIFS_API_LIST_FILE, API_LOCK_READ);
+#ifdef SPIFS_USE_NULL_CHECK
+	if(cursor == NULL || files == NULL) {
+		return API_RETURN(0);
+	}
+#endif
+	if((cursor->position >= fs->fb_slots) || (max == 0)) {
+		return API_RETURN(0);
+	}
+
+	slot = cursor->position;
+	while((slot < fs->fb_slots) && (count < max)) {
+		// 窗口不跨越文件索引扇区, 扇区末尾不足一个文件块的部分不读取
+		end = ((slot / FB_SLOTS_PER_SECTOR + 1) * FB_SLOTS_PER_SECTOR);
+		end = (end < fs->fb_slots) ? end : fs->fb_slots;
+#ifdef SPIFS_USE_FB_SLOTMAP
+		if(fb_slots_ready(fs)) {
+			// 窗口从下一个有效文件块开始, 扇区剩余槽位中没有有效文件块时无需读取
+			for(live = slot; (live < end) && (fb_slots_get(fs, live) != FB_SLOT_LIVE); live++);
+			if(live == end) {
+				slot = end;
+				continue;
+			}
+			slot = live;
+		}
+#endif
+		n = ((end - slot) < FB_SCAN_SLOTS) ? (end - slot) : FB_SCAN_SLOTS;
+		spifs_flash_read(fs, fb_slot_addr(fs, slot), window, (n * FILEBLOCK_SIZE));
+		for(i = 0; (i < n) && (count < max); i++, slot++) {
+			fb = (FileBlock *)((uint8_t *)window + i * FILEBLOCK_SIZE);
+			if(!list_filter_match(fb, filter)) {
+				continue;
+			}
+			// FileBlock转File结构
+			os_memcpy((files + count)->filename, fb->filename, FILENAME_SIZE);
+			os_memcpy((files + count)->extname, fb->extname, EXTNAME_SIZE);
+			(files + count)->block = fb_slot_addr(fs, slot);
+			(files + count)->cluster = fb->cluster;
+			(files + count)->length = fb->length;
+			if(finfos != NULL) {
+				finfos[count] = fb->info;
+			}
+			count++;
+		}
+	}
+	cursor->position = (slot < fs->fb_slots) ? slot : SPIFS_LIST_END;
+	return API_RETURN(count);
+}
+
+/**
+ * @brief 判断文件块是否为有效文件且满足过滤条件
+ * @return 满足TRUE
+ * */
+static BOOL ICACHE_FLASH_ATTR list_filter_match(FileBlock *fb, const SpifsListFilter *filter) {
+	FileStatePack fspack;
+	uint32_t i, length;
+
+	if(!(fb->info.state.del & fb->info.state.dep) || (fb->cluster == EMPTY_INT_VALUE)) {
+		return FALSE;
+	}
+	if(filter == NULL) {
+		return TRUE;
+	}
+	// 要求的状态位(0)在文件状态字中均已置位
+	fspack.fstate = fb->info.state;
+	if((fspack.data | filter->fstate) != filter->fstate) {
+		return FALSE;
+	}
+	if((fb->length < filter->min_length) || ((filter->max_length > 0) && (fb->length > filter->max_length))) {
+		return FALSE;
+	}
+	if(filter->prefix != NULL) {
+		length = os_strlen(filter->prefix);
+		if((length > FILENAME_SIZE) || (os_memcmp(fb->filename, filter->prefix, length) != 0)) {
+			return FALSE;
+		}
+	}
+	if(filter->extname != NULL) {
+		length = os_strlen(filter->extname);
+		if((length > EXTNAME_SIZE) || (os_memcmp(fb->extname, filter->extname, length) != 0)) {
+			return FALSE;
+		}
+		// 拓展名不足EXTNAME_SIZE时以EMPTY_BYTE_VALUE补齐
+		for(i = length; i < EXTNAME_SIZE; i++) {
+			if(fb->extname[i] != EMPTY_BYTE_VALUE) {
+				return FALSE;
+			}
+		}
+	}
+	return TRUE;
 }
 
 /**
@@ -728,268 +1616,1481 @@ uint32_t ICACHE_FLASH_ATTR list_file_raw(uint32_t *startAddr, uint8_t *buffer, u
  * @param *finfo 存放文件信息指针
  * @return FALSE: file=null 或finfo = null, TRUE: 读取成功
  */
-BOOL ICACHE_FLASH_ATTR read_finfo(File *file, FileInfo *finfo) {
-    FileBlock *fb;
-    uint8_t slot_buffer[FILEBLOCK_SIZE];
-
+BOOL ICACHE_FLASH_ATTR read_finfo(spifs_t *fs, File *file, FileInfo *finfo) {
+    LOCK_ENTER(API_LOCK_READ);
 #ifdef SPIFS_USE_NULL_CHECK
     if(file == NULL || finfo == NULL) {
-        return FALSE;
+        return LOCK_RETURN(FALSE);
     }
 #endif
+    read_finfo_impl(fs, file, finfo);
+    return LOCK_RETURN(TRUE);
+}
+
+/**
+ * @brief 读取文件信息实现, 调用者已加锁
+ * @param *file 文件结构指针
+ * @param *finfo 存放文件信息指针
+ */
+static void ICACHE_FLASH_ATTR read_finfo_impl(spifs_t *fs, File *file, FileInfo *finfo) {
+    FileBlock *fb;
+    uint8_t slot_buffer[FILEBLOCK_SIZE];
 
-    spi_flash_read(file->block, (uint32_t *)slot_buffer, sizeof(FileBlock));
+    spifs_flash_read(fs, file->block, (uint32_t *)slot_buffer, sizeof(FileBlock));
     fb = (FileBlock *)slot_buffer;
     os_memcpy(finfo, &(fb->info), sizeof(FileInfo));
-
-    return TRUE;
 }
 
 /**
- * @brief 查找数据区空闲扇区, 不主动回收，读写均衡
- * @param *secList 存放空闲扇区首地址缓冲区
- * @param nums 需要查找的扇区数量
- * @return TRUE: 成功找到nums个空扇区, FALSE: 空扇区数量 < nums
+ * @brief 打开文件句柄, 读取一次文件信息并检查权限
+ * @param *fh 文件句柄
+ * @param *file 已打开或已创建的文件, 内容复制到句柄中
+ * @param mode HandleMode, HANDLE_WRITE要求文件可写
+ * @return FALSE:文件不存在或权限不足, TRUE:成功
  * */
-static BOOL ICACHE_FLASH_ATTR find_empty_sector(uint32_t *secList, uint32_t nums) {
-    uint32_t sector_index, cnt = 0;
-    for(sector_index = DATA_SECTOR_START; ((cnt < nums) && (sector_index < (DATA_SECTOR_END + 1))); sector_index++) {
-    	if(spifs_ftl_get(FTL_WRITABLE_TABLE, sector_index)) {
-			spifs_ftl_mark(FTL_WRITABLE_TABLE, sector_index, FTL_UNMARK);
-			 *(secList + cnt) = (sector_index * SECTOR_SIZE);
-			 cnt++;
-		}
+BOOL ICACHE_FLASH_ATTR open_handle(spifs_t *fs, FileHandle *fh, File *file, uint8_t mode) {
+    API_ENTER(SPIFS_API_OPEN_HANDLE, API_LOCK_READ);
+#ifdef SPIFS_USE_NULL_CHECK
+    if(fh == NULL || file == NULL || file->block == EMPTY_INT_VALUE) {
+        return API_RETURN(FALSE);
     }
-    return (cnt == nums);
-}
-
-/**
- * 删除文件, 此操作不会立即擦除扇区
- * 而将文件状态字标注为被删除,仅在垃圾回收时才会擦除扇区数据
- * @param *file 文件指针
- * */
-void ICACHE_FLASH_ATTR delete_file(File *file) {
-	uint32_t cluster;
-	if(file->block != EMPTY_INT_VALUE) {
-		// 标记文件索引删除
-		write_fileblock_state(file->block, FSTATE_DELETE);
-        // 根据链表标记文件占用扇区废弃
-        while(file->cluster != EMPTY_INT_VALUE) {
-        	spifs_ftl_mark(FTL_ERASABLE_TABLE, (file->cluster / SECTOR_SIZE), FTL_MARK);
-            update_sector_mark(file->cluster, SECTOR_DISCARD_FLAG);
-            spi_flash_read((file->cluster + DATA_AREA_SIZE + SECTOR_MARK_SIZE), &cluster, sizeof(uint32_t));
-            file->cluster = cluster;
-        }
-		file->block = EMPTY_INT_VALUE;
-		file->cluster = EMPTY_INT_VALUE;
-		file->length = EMPTY_INT_VALUE;
-	}
+#endif
+    read_finfo_impl(fs, file, &(fh->finfo));
+    if(!(fh->finfo.state.del & fh->finfo.state.dep)) {
+        return API_RETURN(FALSE);
+    }
+    if((mode & HANDLE_WRITE) && !(fh->finfo.state.rw)) {
+        return API_RETURN(FALSE);
+    }
+    os_memcpy(&(fh->file), file, sizeof(File));
+    fh->tail = EMPTY_INT_VALUE;
+    fh->position = 0;
+    fh->sector = EMPTY_INT_VALUE;
+    fh->sector_index = 0;
+    fh->mode = mode;
+    fh->dirty = FALSE;
+    fh->cache = NULL;
+    return API_RETURN(TRUE);
 }
 
 /**
- * @brief 建立FTL表，上电时调用，仅索引 DATA_SECTOR分区
+ * @brief 从句柄当前位置读取文件, 读取后位置后移
+ * @param *fh 文件句柄
+ * @param *buffer 存储数据缓冲区
+ * @param length 读出字节数
+ * @return 实际读取的大小(bytes)
  * */
-void ICACHE_FLASH_ATTR spifs_ftl_init(void) {
-	uint32_t i, readIn, bitValue;
-
-	os_memset(FTL_ERASABLE_TABLE, 0x00, sizeof(FTL_ERASABLE_TABLE));
-	os_memset(FTL_WRITABLE_TABLE, 0x00, sizeof(FTL_WRITABLE_TABLE));
-
-	for(i = DATA_SECTOR_START; i < (DATA_SECTOR_END + 1); i++) {
-		// LSB      MSB
-		spi_flash_read((i * SECTOR_SIZE), &readIn, sizeof(uint32_t));
-
-		// AA FF FF FF 标记为废弃扇区
-		bitValue = !((readIn >> 4) & 0x1);
-		spifs_ftl_mark(FTL_ERASABLE_TABLE, i, bitValue);
-
-		// FF FF FF FF 空扇区
-		bitValue = (readIn & 0x1);
-		spifs_ftl_mark(FTL_WRITABLE_TABLE, i, bitValue);
-	}
+uint32_t ICACHE_FLASH_ATTR read_handle(spifs_t *fs, FileHandle *fh, uint8_t *buffer, uint32_t length) {
+    uint32_t size;
+    SpifsIovec seg;
+    API_ENTER(SPIFS_API_READ_HANDLE, API_LOCK_READ);
+#ifdef SPIFS_USE_NULL_CHECK
+    if(fh == NULL || buffer == NULL) {
+        return API_RETURN(0);
+    }
+#endif
+    if(!(fh->mode & HANDLE_READ) || (fh->file.cluster == EMPTY_INT_VALUE) || (fh->file.length == EMPTY_INT_VALUE)) {
+        return API_RETURN(0);
+    }
+    seg.base = buffer;
+    seg.length = length;
+    size = read_file_impl(fs, &(fh->file), fh->cache, fh->position, &seg, length, &(fh->sector_index), &(fh->sector));
+    fh->position += size;
+    return API_RETURN(size);
 }
 
 /**
- * @brief 标记FTL擦除表
- * @param position 0~1023
- * @param bitValue only 0 or 1
+ * @brief 在文件尾部追加写入, 写入后位置移至文件尾
+ * @brief 文件大小在close_handle或write_finish时写入文件索引块
+ * @param *fh 文件句柄
+ * @param *buffer 写入数据缓冲区
+ * @param length 写入字节数
+ * @return Result 成功:APPEND_FILE_SUCCESS
  * */
-static void spifs_ftl_mark(uint32_t *table, uint32_t position, uint32_t bitValue) {
-	uint32_t index, offset;
-
-	index = (position / BITS_OF_INTEGER);
-	offset = (position - index * BITS_OF_INTEGER);
-
-	table[index] &= ~((uint32_t)0x1 << offset);
-	table[index] |= (bitValue << offset);
-}
-
-static uint32_t spifs_ftl_get(uint32_t *table, uint32_t position) {
-	uint32_t index, offset, bitValue;
-
-	index = (position / BITS_OF_INTEGER);
-	offset = (position - index * BITS_OF_INTEGER);
-	bitValue = ((table[index] >> offset) & 0x1);
-
-	return bitValue;
+Result ICACHE_FLASH_ATTR write_handle(spifs_t *fs, FileHandle *fh, uint8_t *buffer, uint32_t length) {
+    Result result;
+    SpifsIovec seg;
+    API_ENTER(SPIFS_API_WRITE_HANDLE, API_LOCK_WRITE);
+#ifdef SPIFS_USE_NULL_CHECK
+    if(fh == NULL || buffer == NULL || fh->file.block == EMPTY_INT_VALUE) {
+        return API_RETURN(FILE_NOT_EXIST);
+    }
+#endif
+    if(!(fh->mode & HANDLE_WRITE)) {
+        return API_RETURN(CANNOT_WRITE_FILE);
+    }
+    if(length == 0) {
+        return API_RETURN(APPEND_FILE_SUCCESS);
+    }
+    seg.base = buffer;
+    seg.length = length;
+    result = write_file_impl(fs, &(fh->file), &(fh->finfo), &seg, length, APPEND, &(fh->tail));
+    if(result == APPEND_FILE_SUCCESS) {
+        fh->dirty = TRUE;
+        fh->position = fh->file.length;
+    }
+    return API_RETURN(result);
 }
 
 /**
- * @brief spifs垃圾回收
- * @brief 应用层的删除文件操作并不会从闪存中擦除文件数据, 而是标记其文件块的状态属性为可删除文件
- * @param tp GC类型，GC_TYPE_FILEBLOCK：仅扫描文件索被标记删除/失效/无cluster的item
- * 					GC_TYPE_DATAAREA：仅扫描数据区被标记废弃的扇区
- * 					GC_TYPE_MAJOR：Full GC
- * @param nums 期望GC后回收的数量
- * @return  返回实际回收的数量
- * 			对于GC_TYPE_FILEBLOCK，返回值通常 >= nums
- * 			对于GC_TYPE_DATAAREA，返回值 == nums
- * 			对于GC_TYPE_MAJOR，返回值 = FILEBLOCK回收数量+DATAAREA回收数量
+ * @brief 设置句柄读写位置
+ * @param *fh 文件句柄
+ * @param position 文件偏移量, 不能超过文件大小
+ * @return FALSE:超出文件大小, TRUE:成功
  * */
-uint32_t ICACHE_FLASH_ATTR spifs_gc(GCType tp, uint32_t nums) {
-    FileBlock *fb = NULL;
-    BOOL rewrite = FALSE;
-    uint8_t slot_buffer[FILEBLOCK_SIZE];
-    uint32_t offset, fb_index, count = 0;
-    uint8_t *sector_buffer;
-
-    // 扫描文件索引表查找被标记文件
-    if(tp == GC_TYPE_FILEBLOCK || tp == GC_TYPE_MAJOR) {
-    	sector_buffer = (uint8_t *)os_malloc(sizeof(uint8_t) * SECTOR_SIZE);
-
-    	for(fb_index = FB_SECTOR_START; fb_index < (FB_SECTOR_END + 1); fb_index++) {
-			offset = 0;
-			spi_flash_read((fb_index * SECTOR_SIZE), (uint32_t *)sector_buffer, SECTOR_SIZE);
-			// 最小回收一个扇区
-			while((SECTOR_SIZE - offset) >= FILEBLOCK_SIZE) {
-				os_memcpy(slot_buffer, (sector_buffer + offset), FILEBLOCK_SIZE);
-
-				if(!fb_has_name(slot_buffer)) {
-					offset += FILEBLOCK_SIZE;
-					continue;
-				}
-
-				fb = (FileBlock *)slot_buffer;
-				if((fb->info.state.del) == FILE_STATE_MARKED) {
-					// 文件被标识为删除, 清除文件索引信息
-					clear_fileblock(sector_buffer, offset);
-					rewrite = TRUE;
-					count++;
-				}else if((fb->info.state.dep) == FILE_STATE_MARKED) {
-					// 文件被标记为失效, 清除文件索引信息
-					clear_fileblock(sector_buffer, offset);
-					rewrite = TRUE;
-					count++;
-				}else if(fb->cluster == EMPTY_INT_VALUE) {
-					// 创建文件但未填充数据, 空文件索引
-					clear_fileblock(sector_buffer, offset);
-					rewrite = TRUE;
-					count++;
-				}
-				offset += FILEBLOCK_SIZE;
-			}
-			// 擦除文件索引扇区，回写新文件索引表
-			if(rewrite) {
-				rewrite = FALSE;
-				spi_flash_erase_sector(fb_index);
-				spi_flash_write(fb_index * SECTOR_SIZE, (uint32_t *)sector_buffer, SECTOR_SIZE);
-			}
-			if(tp == GC_TYPE_FILEBLOCK && count >= nums) {
-				// only fileblock and count more than nums
-				break;
-			}
-		}
-		os_free(sector_buffer);
+BOOL ICACHE_FLASH_ATTR seek_handle(FileHandle *fh, uint32_t position) {
+    uint32_t length;
+#ifdef SPIFS_USE_NULL_CHECK
+    if(fh == NULL) {
+        return FALSE;
     }
-
-    // 扫描数据扇区, 查找标记为废弃扇区, fb_index复用做扇区首地址, offset复用做扇区标识符
-    if(tp == GC_TYPE_DATAAREA || tp == GC_TYPE_MAJOR) {
-    	count = (tp == GC_TYPE_DATAAREA) ? 0 : count;
-    	for(fb_index = DATA_SECTOR_START; (fb_index < (DATA_SECTOR_END + 1) && count < nums); fb_index++) {
-    		if(spifs_ftl_get(FTL_ERASABLE_TABLE, fb_index)) {
-    			spifs_ftl_mark(FTL_ERASABLE_TABLE, fb_index, FTL_UNMARK);
-    			spifs_ftl_mark(FTL_WRITABLE_TABLE, fb_index, FTL_MARK);
-    			spi_flash_erase_sector(fb_index);
-				count++;
-    		}
-		}
+#endif
+    length = (fh->file.length == EMPTY_INT_VALUE) ? 0 : fh->file.length;
+    if(position > length) {
+        return FALSE;
     }
-    return count;
+    fh->position = position;
+    return TRUE;
 }
 
 /**
- * @brief 文件系统格式化
- * @brief 仅擦除文件索引块区/数据区扇区，擦除完成后为0xFF
+ * @brief 关闭文件句柄, 有追加写时调用write_finish更新文件大小
+ * @param *fh 文件句柄, 关闭后fh->file为最新的文件信息
+ * @return FALSE:更新文件索引块失败, TRUE:成功
  * */
-void ICACHE_FLASH_ATTR spifs_format() {
-	uint32_t sector;
-	// 擦除文件索引块扇区
-	for(sector = FB_SECTOR_START; sector < (FB_SECTOR_END + 1); sector++) {
-		spi_flash_erase_sector(sector);
-	}
-	// 擦除数据区扇区
-	for(sector = DATA_SECTOR_START; sector < (DATA_SECTOR_END + 1); sector++) {
-		spifs_ftl_mark(FTL_ERASABLE_TABLE, sector, FTL_UNMARK);
-        spifs_ftl_mark(FTL_WRITABLE_TABLE, sector, FTL_MARK);
-		spi_flash_erase_sector(sector);
-	}
+BOOL ICACHE_FLASH_ATTR close_handle(spifs_t *fs, FileHandle *fh) {
+    BOOL success = TRUE;
+    API_ENTER(SPIFS_API_CLOSE_HANDLE, API_LOCK_WRITE);
+#ifdef SPIFS_USE_NULL_CHECK
+    if(fh == NULL) {
+        return API_RETURN(FALSE);
+    }
+#endif
+    if(fh->dirty) {
+        success = (write_finish_impl(fs, &(fh->file)) == APPEND_FILE_FINISH);
+        fh->dirty = FALSE;
+    }
+    fh->mode = 0;
+    return API_RETURN(success);
 }
 
 /**
- * @brief 效果等同于spifs_format
- * @note spifs_erase_sector一次只擦除一个扇区，适用于不能阻塞CPU的场合
- * @param sec 扇区编号 FB_SECTOR_START~FB_SECTOR_END or DATA_SECTOR_START~DATA_SECTOR_END
+ * @brief 为文件句柄挂载簇链缓存, 句柄读取定位扇区时按需填充
+ * @brief 首簇地址变化时缓存自动失效, 追加写不影响已缓存的扇区; 句柄打开期间经其他途径覆盖写/改写文件后需重新挂载
+ * @param *fh 文件句柄, 需先由open_handle打开
+ * @param *cache 缓存结构, 为NULL时卸载缓存
+ * @param *sectors 扇区首地址表, 容量capacity
+ * @param capacity 扇区首地址表容量, 完整缓存需要 文件扇区数 / interval + 1
+ * @param interval 采样间隔, 1:缓存每个扇区, N:每N个扇区记录一次, 定位时最多读取N-1次链表
  * */
-BOOL ICACHE_FLASH_ATTR spifs_erase_sector(uint32_t sec) {
-	sec &= 0xFFFF;
-	if((sec >= FB_SECTOR_START) && (sec < FB_SECTOR_END + 1)) {
-		spi_flash_erase_sector(sec);
-		return TRUE;
-	}
-	if((sec >= DATA_SECTOR_START) && (sec < DATA_SECTOR_END + 1)) {
-		spifs_ftl_mark(FTL_ERASABLE_TABLE, sec, FTL_UNMARK);
-        spifs_ftl_mark(FTL_WRITABLE_TABLE, sec, FTL_MARK);
-		spi_flash_erase_sector(sec);
-		return TRUE;
-	}
-	return FALSE;
+void ICACHE_FLASH_ATTR attach_cluster_cache(FileHandle *fh, ClusterCache *cache, uint32_t *sectors, uint16_t capacity, uint16_t interval) {
+#ifdef SPIFS_USE_NULL_CHECK
+    if(fh == NULL) return;
+#endif
+    if(cache != NULL) {
+        cache->cluster = EMPTY_INT_VALUE;
+        cache->sectors = sectors;
+        cache->capacity = (sectors == NULL) ? 0 : capacity;
+        cache->interval = (interval == 0) ? 1 : interval;
+        cache->filled = 0;
+    }
+    fh->cache = cache;
 }
 
 /**
- * @brief 查询flash数据区可用扇区数量
- * @return 空闲的扇区
+ * @brief 定位文件簇链中第index个扇区, 使用并填充簇链缓存
+ * @param *file 文件指针, file->cluster不为空
+ * @param *cache 簇链缓存, 可为NULL
+ * @param index 扇区序号, 以0为基准
+ * @return 扇区首地址
  * */
-uint32_t ICACHE_FLASH_ATTR spifs_avail_sector() {
-    uint32_t i, avail = 0;
-    uint32_t mark1, mark2;
+static uint32_t ICACHE_FLASH_ATTR cluster_seek(spifs_t *fs, File *file, ClusterCache *cache, uint32_t index) {
+    uint32_t addr = file->cluster, from = 0, k;
+
+    if(cache != NULL && cache->capacity > 0) {
+        if(cache->cluster != file->cluster || cache->filled == 0) {
+            cache->cluster = file->cluster;
+            cache->sectors[0] = file->cluster;
+            cache->filled = 1;
+        }
+        k = (index / cache->interval);
+        if(k >= cache->filled) {
+            k = (cache->filled - 1);
+        }
+        addr = cache->sectors[k];
+        from = (k * cache->interval);
+    }
 
-    for(i = DATA_SECTOR_START; i < (DATA_SECTOR_END + 1); i++) {
-    	mark1 = spifs_ftl_get(FTL_ERASABLE_TABLE, i);
-    	mark2 = spifs_ftl_get(FTL_WRITABLE_TABLE, i);
-    	if(mark1 || mark2) {
-    		// SECTOR_DISCARD_FLAG & EMPTY_INT_VALUE都认为是空闲扇区
-    		avail++;
-    	}
+    while(from < index) {
+        spifs_flash_read(fs, (addr + SECTOR_MARK_SIZE + DATA_AREA_SIZE), &addr, sizeof(uint32_t));
+        from++;
+        if(cache != NULL && (from == cache->filled * cache->interval) && (cache->filled < cache->capacity)) {
+            cache->sectors[cache->filled++] = addr;
+        }
     }
-    return avail;
+    return addr;
+}
+
+/**
+ * @brief 查找数据区空闲扇区, 不主动回收，读写均衡
+ * @param *secList 存放空闲扇区首地址缓冲区
+ * @param nums 需要查找的扇区数量
+ * @return TRUE: 成功找到nums个空扇区, FALSE: 空扇区数量 < nums
+ * */
+static BOOL ICACHE_FLASH_ATTR find_empty_sector(spifs_t *fs, uint32_t *secList, uint32_t nums) {
+    uint32_t i;
+
+    ftl_load_writable(fs, nums);
+    if(fs->ftl_writable.count < nums) {
+        return FALSE;
+    }
+#ifdef SPIFS_USE_WEAR_LEVELING
+    if(ftl_pick(fs, &fs->ftl_writable, secList, nums, &fs->alloc_cursor) < nums) {
+        return FALSE;
+    }
+#else
+    if(ftl_pick(fs, &fs->ftl_writable, secList, nums, NULL) < nums) {
+        return FALSE;
+    }
+#endif
+    // 空扇区数量足够时才从FTL表中取出
+    for(i = 0; i < nums; i++) {
+        spifs_ftl_mark(fs, &fs->ftl_writable, secList[i], FTL_UNMARK);
+        secList[i] *= SECTOR_SIZE;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief 从FTL表中选取nums个置位的数据区扇区, 不修改FTL表
+ * @brief 启用磨损均衡时从游标处轮转查找, 先选擦除次数 <= (最小值 + SPIFS_WEAR_THRESHOLD)的扇区, 不足时再选其余扇区;
+ * @brief 最小值取table->least, 不重新扫描; 第一轮走完整张表仍不足时, 以沿途最小擦除次数修正过期的下界并重新选取
+ * @brief 未启用磨损均衡时按扇区号升序选取
+ * @param *table &fs->ftl_writable or &fs->ftl_erasable
+ * @param *secList 存放选取的扇区编号
+ * @param nums 需要选取的数量
+ * @param *cursor 轮转游标, 返回时指向最后选取扇区的下一扇区, 为NULL时从DATA_SECTOR_START开始且不更新
+ * @return 实际选取数量
+ * */
+static uint32_t ICACHE_FLASH_ATTR ftl_pick(spifs_t *fs, FtlTable *table, uint32_t *secList, uint32_t nums, uint32_t *cursor) {
+    uint32_t bit, cnt = 0;
+#ifdef SPIFS_USE_WEAR_LEVELING
+    uint32_t pass = 0, first, wear, seen, start;
+    BOOL wrapped;
+
+    if(table->count == 0) {
+        return 0;
+    }
+    start = (cursor != NULL) ? *cursor : fs->data_start;
+    // pass 0: 磨损较少的扇区, pass 1: 其余扇区, 均从游标处查找到末尾后回绕
+    while((pass < 2) && (cnt < nums)) {
+        first = (cursor != NULL) ? (*cursor - fs->data_start) : 0;
+        seen = EMPTY_INT_VALUE;
+        bit = bitmap_next_set(table->map, fs->data_sectors, first);
+        wrapped = FALSE;
+        while(cnt < nums) {
+            if(bit == BITMAP_NONE) {
+                if(wrapped || (first == 0)) {
+                    break;
+                }
+                wrapped = TRUE;
+                bit = bitmap_next_set(table->map, fs->data_sectors, 0);
+                continue;
+            }
+            if(wrapped && (bit >= first)) {
+                break;
+            }
+            wear = fs->erase_count[bit];
+            seen = (wear < seen) ? wear : seen;
+            if((pass == 0) == (wear <= table->least + SPIFS_WEAR_THRESHOLD)) {
+                secList[cnt++] = (fs->data_start + bit);
+                if(cursor != NULL) {
+                    *cursor = (bit + 1 < fs->data_sectors) ? (fs->data_start + bit + 1) : fs->data_start;
+                }
+            }
+            bit = bitmap_next_set(table->map, fs->data_sectors, bit + 1);
+        }
+        if((pass == 0) && (cnt < nums) && (seen > table->least)) {
+            // 第一轮已遍历整张表, 沿途最小值即准确最小值, 下界过期时修正后重选
+            table->least = seen;
+            cnt = 0;
+            if(cursor != NULL) {
+                *cursor = start;
+            }
+            continue;
+        }
+        pass++;
+    }
+#else
+    for(bit = bitmap_next_set(table->map, fs->data_sectors, 0); (cnt < nums) && (bit != BITMAP_NONE); bit = bitmap_next_set(table->map, fs->data_sectors, bit + 1)) {
+        secList[cnt++] = (fs->data_start + bit);
+    }
+#endif
+    return cnt;
+}
+
+/**
+ * @brief 擦除数据区扇区并更新FTL表, 启用磨损均衡时RAM中擦除次数加1, 随下次写入的扇区标记字保存
+ * @param sec 扇区编号 fs->data_start~fs->data_end
+ * */
+static void ICACHE_FLASH_ATTR data_sector_erase(spifs_t *fs, uint32_t sec) {
+    data_run_erase(fs, sec, sec);
+}
+
+/**
+ * @brief 擦除数据区连续扇区[start, end]并更新FTL表, 对齐的整块使用块擦除
+ * @param start 首扇区编号 fs->data_start~fs->data_end
+ * @param end 末扇区编号 start~fs->data_end
+ * */
+static void ICACHE_FLASH_ATTR data_run_erase(spifs_t *fs, uint32_t start, uint32_t end) {
+    uint32_t sec;
+
+#ifdef SPIFS_USE_ERASE_RESERVE
+    // 先结束后台擦除, 避免同一扇区擦除次数被重复累计
+    reserve_finish(fs);
+#endif
+    // 擦除次数在区域载入时读出
+    for(sec = ((start - fs->data_start) / BITS_OF_INTEGER); sec <= ((end - fs->data_start) / BITS_OF_INTEGER); sec++) {
+        ftl_region_load(fs, sec);
+    }
+#ifdef SPIFS_USE_CHECKPOINT
+    // 擦除前标记检查点失效, 擦除中断时挂载不会载入过期的检查点
+    ckpt_touch(fs);
+#endif
+    flash_erase_run(fs, start, end);
+    for(sec = start; sec <= end; sec++) {
+        data_sector_erased(fs, sec);
+    }
+}
+
+/**
+ * @brief 擦除连续扇区[start, end], 按块对齐的64KB/32KB整块使用块擦除, 其余逐扇区擦除
+ * @param start 首扇区编号
+ * @param end 末扇区编号
+ * */
+static void ICACHE_FLASH_ATTR flash_erase_run(spifs_t *fs, uint32_t start, uint32_t end) {
+    uint32_t secs;
+
+    while(start <= end) {
+        secs = 0;
+        if(fs->ops->erase_block != NULL) {
+            if(((start % SPI_FLASH_BLOCK64_SECS) == 0) && ((end - start + 1) >= SPI_FLASH_BLOCK64_SECS)) {
+                secs = SPI_FLASH_BLOCK64_SECS;
+            }else if(((start % SPI_FLASH_BLOCK32_SECS) == 0) && ((end - start + 1) >= SPI_FLASH_BLOCK32_SECS)) {
+                secs = SPI_FLASH_BLOCK32_SECS;
+            }
+        }
+        if((secs != 0) && (spifs_ops_erase_block(fs, start, secs) == SPI_FLASH_RESULT_OK)) {
+#ifdef SPIFS_USE_CACHE
+            cache_invalidate(fs, start, secs);
+#endif
+        }else {
+            spifs_flash_erase(fs, start);
+            secs = 1;
+        }
+        start += secs;
+    }
+}
+
+/**
+ * @brief 数据区扇区擦除完成后更新FTL表, 启用磨损均衡时RAM中擦除次数加1
+ * @brief 空白扇区标记字保持全1, 擦除次数随首次写入的使用中/废弃标记一并编程, 不额外编程
+ * @param sec 扇区编号 fs->data_start~fs->data_end
+ * */
+static void ICACHE_FLASH_ATTR data_sector_erased(spifs_t *fs, uint32_t sec) {
+#ifdef SPIFS_USE_WEAR_LEVELING
+    uint32_t *wear = &fs->erase_count[sec - fs->data_start];
+
+    if(*wear < SECTOR_WEAR_MAX) {
+        (*wear)++;
+    }
+#endif
+    spifs_ftl_mark(fs, &fs->ftl_erasable, sec, FTL_UNMARK);
+    spifs_ftl_mark(fs, &fs->ftl_writable, sec, FTL_MARK);
+}
+
+/**
+ * @brief 设置预擦除扇区储备低水位
+ * @param low_water 空白扇区少于该值时spifs_reserve_step开始擦除废弃扇区, 0表示关闭
+ * */
+void ICACHE_FLASH_ATTR spifs_reserve_config(spifs_t *fs, uint32_t low_water) {
+#ifdef SPIFS_USE_ERASE_RESERVE
+    LOCK_ENTER(API_LOCK_WRITE);
+    fs->reserve_low_water = low_water;
+    LOCK_LEAVE();
+#endif
+}
+
+/**
+ * @brief 预擦除扇区储备状态机, 由定时器或空闲回调周期调用, 不等待擦除完成
+ * @brief 空闲: 空白扇区低于低水位时选取一个废弃扇区发起擦除
+ * @brief 擦除中: 查询flash BUSY, 擦除结束后将扇区标记为可写
+ * @brief 延迟挂载且FTL未全部载入时, 每次调用载入一个区域
+ * @return TRUE: 有擦除正在进行或刚完成, 需要继续调用; FALSE: 储备已满或无可擦除扇区
+ * */
+BOOL ICACHE_FLASH_ATTR spifs_reserve_step(spifs_t *fs) {
+#ifdef SPIFS_USE_ERASE_RESERVE
+    uint32_t sec;
+    API_ENTER(SPIFS_API_RESERVE_STEP, API_LOCK_WRITE);
+
+    if(fs->reserve_sector != EMPTY_INT_VALUE) {
+        if((fs->ops->busy == NULL) || !fs->ops->busy(fs->flash)) {
+            reserve_finish(fs);
+        }
+        return API_RETURN(TRUE);
+    }
+    if(fs->ftl_pending > 0) {
+        // 延迟挂载时每次调用在后台载入一个FTL区域
+        for(sec = 0; BITMAP_GET(fs->ftl_loaded, sec); sec++);
+        ftl_region_load(fs, sec);
+        return API_RETURN(TRUE);
+    }
+    if(fs->ftl_writable.count >= fs->reserve_low_water) {
+        return API_RETURN(FALSE);
+    }
+#ifdef SPIFS_USE_WEAR_LEVELING
+    if(ftl_pick(fs, &fs->ftl_erasable, &sec, 1, &fs->gc_cursor) == 0) {
+        return API_RETURN(FALSE);
+    }
+#else
+    if(ftl_pick(fs, &fs->ftl_erasable, &sec, 1, NULL) == 0) {
+        return API_RETURN(FALSE);
+    }
+#endif
+    // 擦除期间扇区既不可写也不可擦除, 不会被分配或被GC重复选取
+    if(fs->ops->erase_start == NULL) {
+        // flash不支持后台擦除, 退化为阻塞擦除
+        data_sector_erase(fs, sec);
+        return API_RETURN(TRUE);
+    }
+    spifs_ftl_mark(fs, &fs->ftl_erasable, sec, FTL_UNMARK);
+    fs->reserve_sector = sec;
+#ifdef SPIFS_USE_CACHE
+    cache_invalidate(fs, sec, 1);
+#endif
+    spifs_ops_erase_start(fs, sec);
+    return API_RETURN(TRUE);
+#else
+    return FALSE;
+#endif
+}
+
+/**
+ * @brief 结束后台擦除, flash仍忙时由flash驱动等待擦除完成
+ * */
+static void ICACHE_FLASH_ATTR reserve_finish(spifs_t *fs) {
+#ifdef SPIFS_USE_ERASE_RESERVE
+    uint32_t sec = fs->reserve_sector;
+
+    if(sec != EMPTY_INT_VALUE) {
+        fs->reserve_sector = EMPTY_INT_VALUE;
+        data_sector_erased(fs, sec);
+    }
+#endif
+}
+
+/**
+ * @brief 生成扇区标记字, 启用磨损均衡时高24位附带擦除次数
+ * @param secAddr 扇区首地址
+ * @param flag SECTOR_INUSE_FLAG/SECTOR_DISCARD_FLAG/EMPTY_INT_VALUE
+ * @return 扇区标记字
+ * */
+static uint32_t ICACHE_FLASH_ATTR sector_mark(spifs_t *fs, uint32_t secAddr, uint32_t flag) {
+#ifdef SPIFS_USE_WEAR_LEVELING
+    uint32_t sec = (secAddr / SECTOR_SIZE);
+    if(sec >= fs->data_start && sec < (fs->data_end + 1)) {
+        if(!BITMAP_GET(fs->ftl_loaded, ((sec - fs->data_start) / BITS_OF_INTEGER))) {
+            // 区域未载入, 擦除次数位全1写入, 保留flash上已有的擦除次数
+            return (~(uint32_t)SECTOR_STATE_MASK | (flag & SECTOR_STATE_MASK));
+        }
+        return ((fs->erase_count[sec - fs->data_start] << SECTOR_WEAR_SHIFT) | (flag & SECTOR_STATE_MASK));
+    }
+#endif
+    return flag;
+}
+
+#ifdef SPIFS_USE_STATS
+/**
+ * @brief 进入API统计槽位, 已处于某槽位时保持不变, 嵌套调用计入最外层API
+ * @param api SpifsApi
+ * @return 进入前的槽位, 传给stats_leave
+ * */
+static uint32_t ICACHE_FLASH_ATTR stats_enter(spifs_t *fs, uint32_t api) {
+    uint32_t prev = fs->stats_api;
+    if(prev == SPIFS_API_NONE) {
+        fs->stats_api = api;
+        fs->stats[api].calls++;
+    }
+    return prev;
+}
+
+/**
+ * @brief 离开API统计槽位, 恢复进入前的槽位
+ * @param prev stats_enter返回值
+ * @param value 透传返回值, 便于在return语句中使用
+ * @return value
+ * */
+static uint32_t ICACHE_FLASH_ATTR stats_leave(spifs_t *fs, uint32_t prev, uint32_t value) {
+    fs->stats_api = prev;
+    return value;
+}
+
+/**
+ * @brief 读取本实例各API的flash操作统计
+ * @param *stats 输出数组, 长度SPIFS_API_COUNT, 下标为SpifsApi
+ * */
+void ICACHE_FLASH_ATTR spifs_stats_snapshot(spifs_t *fs, SpifsFlashStats *stats) {
+    LOCK_ENTER(API_LOCK_READ);
+    os_memcpy(stats, fs->stats, sizeof(fs->stats));
+    LOCK_LEAVE();
+}
+
+/**
+ * @brief 清零本实例flash操作统计
+ * */
+void ICACHE_FLASH_ATTR spifs_stats_reset(spifs_t *fs) {
+    LOCK_ENTER(API_LOCK_WRITE);
+    os_memset(fs->stats, 0x00, sizeof(fs->stats));
+    LOCK_LEAVE();
+}
+#endif
+
+#ifdef SPIFS_USE_CACHE
+/**
+ * @brief 读取读缓存命中统计
+ * @param *stats 输出统计
+ * */
+void ICACHE_FLASH_ATTR spifs_cache_stats(spifs_t *fs, SpifsCacheStats *stats) {
+    // 持读锁的API在缓存互斥内更新命中统计, 持写锁读取一致的快照
+    LOCK_ENTER(API_LOCK_WRITE);
+    os_memcpy(stats, &fs->cache_stats, sizeof(SpifsCacheStats));
+    LOCK_LEAVE();
+}
+
+/**
+ * @brief 清零读缓存命中统计, 不影响缓存内容
+ * */
+void ICACHE_FLASH_ATTR spifs_cache_stats_reset(spifs_t *fs) {
+    LOCK_ENTER(API_LOCK_WRITE);
+    os_memset(&fs->cache_stats, 0x00, sizeof(SpifsCacheStats));
+    LOCK_LEAVE();
+}
+#endif
+
+/**
+ * @brief 查询数据区扇区擦除次数
+ * @param sec 扇区编号 fs->data_start~fs->data_end
+ * @return 擦除次数, 未启用磨损均衡或扇区编号无效时返回0
+ * */
+uint32_t ICACHE_FLASH_ATTR spifs_erase_count(spifs_t *fs, uint32_t sec) {
+#ifdef SPIFS_USE_WEAR_LEVELING
+    if(sec >= fs->data_start && sec < (fs->data_end + 1)) {
+        // 延迟挂载时可能需要载入区域, 持写锁
+        LOCK_ENTER(API_LOCK_WRITE);
+        ftl_region_load(fs, ((sec - fs->data_start) / BITS_OF_INTEGER));
+        return LOCK_RETURN(fs->erase_count[sec - fs->data_start]);
+    }
+#endif
+    return 0;
+}
+
+/**
+ * 删除文件, 此操作不会立即擦除扇区
+ * 而将文件状态字标注为被删除,仅在垃圾回收时才会擦除扇区数据
+ * @param *file 文件指针
+ * */
+void ICACHE_FLASH_ATTR delete_file(spifs_t *fs, File *file) {
+	uint32_t cluster;
+	API_ENTER(SPIFS_API_DELETE_FILE, API_LOCK_WRITE);
+	if(file->block != EMPTY_INT_VALUE) {
+		// 标记文件索引删除
+		fileblock_retire(fs, file, FSTATE_DELETE);
+        // 根据链表标记文件占用扇区废弃
+        while(file->cluster != EMPTY_INT_VALUE) {
+        	spifs_ftl_mark(fs, &fs->ftl_erasable, (file->cluster / SECTOR_SIZE), FTL_MARK);
+            update_sector_mark(fs, file->cluster, sector_mark(fs, file->cluster, SECTOR_DISCARD_FLAG));
+            spifs_flash_read(fs, (file->cluster + DATA_AREA_SIZE + SECTOR_MARK_SIZE), &cluster, sizeof(uint32_t));
+            file->cluster = cluster;
+        }
+		file->block = EMPTY_INT_VALUE;
+		file->cluster = EMPTY_INT_VALUE;
+		file->length = EMPTY_INT_VALUE;
+	}
+	API_LEAVE();
+}
+
+#ifdef SPIFS_USE_LOCK
+/**
+ * @brief API入口加锁, 未配置读写锁接口时不加锁
+ * @param mode API_LOCK_READ/API_LOCK_WRITE
+ * @return mode, 传给api_lock_leave
+ * */
+static uint8_t ICACHE_FLASH_ATTR api_lock_enter(spifs_t *fs, uint8_t mode) {
+#ifdef SPIFS_USE_STATS
+	// 统计槽位为实例状态, API互斥执行时flash操作才能计入正确的API
+	mode = API_LOCK_WRITE;
+#endif
+#ifdef SPIFS_USE_CACHE
+	// 读取会载入/淘汰缓存内容, 锁接口未提供互斥锁保护缓存时只读API同样独占
+	if((fs->lock_ops != NULL) && (fs->lock_ops->mutex_lock == NULL) && ((fs->cache_fb != NULL) || (fs->cache_pages > 0))) {
+		mode = API_LOCK_WRITE;
+	}
+#endif
+	if(fs->lock_ops != NULL) {
+		if(mode == API_LOCK_READ) {
+			fs->lock_ops->read_lock(fs->lock);
+		}else {
+			fs->lock_ops->write_lock(fs->lock);
+		}
+	}
+	return mode;
+}
+
+/**
+ * @brief API返回前解锁
+ * @param mode api_lock_enter返回值
+ * @param value 透传返回值, 便于在return语句中使用
+ * @return value
+ * */
+static uint32_t ICACHE_FLASH_ATTR api_lock_leave(spifs_t *fs, uint8_t mode, uint32_t value) {
+	if(fs->lock_ops != NULL) {
+		if(mode == API_LOCK_READ) {
+			fs->lock_ops->read_unlock(fs->lock);
+		}else {
+			fs->lock_ops->write_unlock(fs->lock);
+		}
+	}
+	return value;
+}
+#endif
+
+/**
+ * @brief 默认配置: 默认分区FB_SECTOR_START~DATA_SECTOR_END, flash操作接口为spi_flash_read/spi_flash_write等
+ * @param *cfg 输出配置
+ * */
+void ICACHE_FLASH_ATTR spifs_default_config(SpifsConfig *cfg) {
+	cfg->fb_start = FB_SECTOR_START;
+	cfg->fb_end = FB_SECTOR_END;
+	cfg->data_start = DATA_SECTOR_START;
+	cfg->data_end = DATA_SECTOR_END;
+#ifdef SPIFS_USE_CHECKPOINT
+	cfg->checkpoint_sector = SPIFS_CHECKPOINT_SECTOR;
+#else
+	cfg->checkpoint_sector = EMPTY_INT_VALUE;
+#endif
+	cfg->lazy_mount = FALSE;
+	cfg->ops = &SPIFS_SPI_FLASH_OPS;
+	cfg->flash = NULL;
+	cfg->lock_ops = NULL;
+	cfg->lock = NULL;
+	cfg->mmap_base = NULL;
+	cfg->cache_fb = FALSE;
+	cfg->cache_pages = 0;
+	cfg->gc_buffer = NULL;
+}
+
+/**
+ * @brief 初始化文件系统实例, 按分区大小分配FTL表与RAM索引, 不访问flash
+ * @brief 之后调用spifs_format格式化或spifs_ftl_init挂载已有文件系统
+ * @param *fs 文件系统实例
+ * @param *cfg 配置, 初始化后不再引用
+ * @return 成功TRUE, 配置无效或内存不足FALSE
+ * */
+BOOL ICACHE_FLASH_ATTR spifs_init(spifs_t *fs, const SpifsConfig *cfg) {
+	uint32_t ckpt_last;
+
+#ifdef SPIFS_USE_NULL_CHECK
+	if(fs == NULL || cfg == NULL) {
+		return FALSE;
+	}
+#endif
+	os_memset(fs, 0x00, sizeof(spifs_t));
+	if((cfg->ops == NULL) || (cfg->ops->read == NULL) || (cfg->ops->write == NULL) || (cfg->ops->erase == NULL)
+			|| (cfg->fb_end < cfg->fb_start) || (cfg->data_end < cfg->data_start)
+			|| ((cfg->fb_end - cfg->fb_start + 1) * FB_SLOTS_PER_SECTOR > FB_SLOT_MAX)) {
+		return FALSE;
+	}
+#ifdef SPIFS_USE_LOCK
+	if((cfg->lock_ops != NULL) && ((cfg->lock_ops->read_lock == NULL) || (cfg->lock_ops->read_unlock == NULL)
+			|| (cfg->lock_ops->write_lock == NULL) || (cfg->lock_ops->write_unlock == NULL))) {
+		return FALSE;
+	}
+#endif
+	// 检查点扇区不能与文件索引区/数据区重叠, 数据区较大时检查点占用多个连续扇区
+	ckpt_last = cfg->checkpoint_sector;
+#ifdef SPIFS_USE_CHECKPOINT
+	if(cfg->checkpoint_sector != EMPTY_INT_VALUE) {
+		ckpt_last = (cfg->checkpoint_sector + ckpt_sectors(cfg->data_end - cfg->data_start + 1) - 1);
+	}
+#endif
+	if((cfg->checkpoint_sector != EMPTY_INT_VALUE)
+			&& (((cfg->checkpoint_sector <= cfg->fb_end) && (ckpt_last >= cfg->fb_start))
+			|| ((cfg->checkpoint_sector <= cfg->data_end) && (ckpt_last >= cfg->data_start)))) {
+		return FALSE;
+	}
+	fs->fb_start = cfg->fb_start;
+	fs->fb_end = cfg->fb_end;
+	fs->data_start = cfg->data_start;
+	fs->data_end = cfg->data_end;
+	fs->fb_slots = (cfg->fb_end - cfg->fb_start + 1) * FB_SLOTS_PER_SECTOR;
+	fs->data_sectors = (cfg->data_end - cfg->data_start + 1);
+	fs->ops = cfg->ops;
+	fs->flash = cfg->flash;
+#ifdef SPIFS_USE_MMAP
+	fs->mmap_base = cfg->mmap_base;
+#endif
+
+	fs->ftl_words = (fs->data_sectors + BITS_OF_INTEGER - 1) / BITS_OF_INTEGER;
+	fs->ftl_erasable.map = (uint32_t *)os_malloc(fs->ftl_words * sizeof(uint32_t));
+	fs->ftl_writable.map = (uint32_t *)os_malloc(fs->ftl_words * sizeof(uint32_t));
+	fs->ftl_loaded = (uint32_t *)os_malloc(BITMAP_WORDS(fs->ftl_words) * sizeof(uint32_t));
+	if(fs->ftl_erasable.map == NULL || fs->ftl_writable.map == NULL || fs->ftl_loaded == NULL) {
+		spifs_unmount(fs);
+		return FALSE;
+	}
+	ftl_clear(fs);
+#ifdef SPIFS_USE_WEAR_LEVELING
+	fs->erase_count = (uint32_t *)os_malloc(fs->data_sectors * sizeof(uint32_t));
+	if(fs->erase_count == NULL) {
+		spifs_unmount(fs);
+		return FALSE;
+	}
+	os_memset(fs->erase_count, 0x00, fs->data_sectors * sizeof(uint32_t));
+	fs->alloc_cursor = fs->data_start;
+	fs->gc_cursor = fs->data_start;
+#endif
+#ifdef SPIFS_USE_ERASE_RESERVE
+	fs->reserve_low_water = SPIFS_RESERVE_SECTORS;
+	fs->reserve_sector = EMPTY_INT_VALUE;
+#endif
+	fs->lazy_mount = cfg->lazy_mount;
+	fs->gc_buffer = cfg->gc_buffer;
+	if(fs->gc_buffer == NULL) {
+		// 回收文件索引扇区需要整扇区缓冲区, 挂载时分配一次, GC路径不再分配
+		fs->gc_buffer = (uint8_t *)os_malloc(SECTOR_SIZE);
+		fs->gc_buffer_owned = TRUE;
+		if(fs->gc_buffer == NULL) {
+			spifs_unmount(fs);
+			return FALSE;
+		}
+	}
+#ifdef SPIFS_USE_LOCK
+	fs->lock_ops = cfg->lock_ops;
+	fs->lock = cfg->lock;
+#endif
+#ifdef SPIFS_USE_CHECKPOINT
+	fs->ckpt_sector = cfg->checkpoint_sector;
+	fs->ckpt_seq = 0;
+	fs->ckpt_clean = FALSE;
+#endif
+	if(!fb_tables_alloc(fs)) {
+		spifs_unmount(fs);
+		return FALSE;
+	}
+#ifdef SPIFS_USE_CACHE
+	if(!cache_alloc(fs, cfg->cache_fb, cfg->cache_pages)) {
+		spifs_unmount(fs);
+		return FALSE;
+	}
+#endif
+	return TRUE;
+}
+
+/**
+ * @brief 初始化文件系统实例并挂载flash上已有的文件系统
+ * @param *fs 文件系统实例
+ * @param *cfg 配置
+ * @return 成功TRUE
+ * */
+BOOL ICACHE_FLASH_ATTR spifs_mount(spifs_t *fs, const SpifsConfig *cfg) {
+	if(!spifs_init(fs, cfg)) {
+		return FALSE;
+	}
+	spifs_ftl_init(fs);
+	return TRUE;
+}
+
+/**
+ * @brief 卸载文件系统实例, 等待后台擦除结束, 写入FTL检查点并释放spifs_init分配的内存
+ * @brief 未结束的追加写需先调用write_finish
+ * @param *fs 文件系统实例
+ * */
+void ICACHE_FLASH_ATTR spifs_unmount(spifs_t *fs) {
+#ifdef SPIFS_USE_NULL_CHECK
+	if(fs == NULL) {
+		return;
+	}
+#endif
+	if(fs->ftl_valid) {
+		reserve_finish(fs);
+#ifdef SPIFS_USE_CHECKPOINT
+		// 延迟挂载且FTL未全部载入时不写入检查点, 只读启动无需在关机时扫描数据区
+		if(fs->ftl_pending == 0) {
+			spifs_checkpoint(fs);
+		}
+#endif
+	}
+	fs->ftl_valid = FALSE;
+	os_free(fs->ftl_erasable.map);
+	os_free(fs->ftl_writable.map);
+	os_free(fs->ftl_loaded);
+	fs->ftl_erasable.map = NULL;
+	fs->ftl_writable.map = NULL;
+	fs->ftl_loaded = NULL;
+#ifdef SPIFS_USE_WEAR_LEVELING
+	os_free(fs->erase_count);
+	fs->erase_count = NULL;
+#endif
+	fb_tables_free(fs);
+#ifdef SPIFS_USE_CACHE
+	cache_free(fs);
+#endif
+	if(fs->gc_buffer_owned) {
+		os_free(fs->gc_buffer);
+		fs->gc_buffer_owned = FALSE;
+	}
+	fs->gc_buffer = NULL;
+}
+
+/**
+ * @brief 建立FTL表，上电时调用，索引 DATA_SECTOR分区并建立文件索引区RAM索引
+ * @brief 延迟挂载时仅尝试载入检查点, FTL表在分配/空间查询时按区域载入, 文件索引区RAM索引在首次创建文件时建立
+ * */
+void ICACHE_FLASH_ATTR spifs_ftl_init(spifs_t *fs) {
+	API_ENTER(SPIFS_API_FTL_INIT, API_LOCK_WRITE);
+
+	reserve_finish(fs);
+
+	if(fs->lazy_mount) {
+		// 索引建立前打开文件回退到扫描文件索引区
+#ifdef SPIFS_USE_FB_INDEX
+		fb_index_invalidate(fs);
+#endif
+#ifdef SPIFS_USE_FB_SLOTMAP
+		fb_slots_invalidate(fs);
+#endif
+		fs->fb_pending = TRUE;
+	}else {
+		spifs_fb_scan(fs);
+	}
+
+	ftl_clear(fs);
+#ifdef SPIFS_USE_CHECKPOINT
+	// 检查点有效时无需逐扇区读取标记字
+	if(ckpt_load(fs)) {
+		bitmap_fill(fs->ftl_loaded, 0, fs->ftl_words, 1);
+		fs->ftl_pending = 0;
+	}else {
+		ftl_clear(fs);
+	}
+#endif
+	if(!fs->lazy_mount) {
+		ftl_load_all(fs);
+	}
+	fs->ftl_valid = TRUE;
+	API_LEAVE();
+}
+
+/**
+ * @brief 载入FTL区域, 读取区域内数据区扇区标记字, 建立FTL表与擦除次数
+ * @brief 空白扇区标记字不含擦除次数, 按区域内已记录的最大擦除次数估计, 检查点有效时不经过此处
+ * @param region 区域编号, 即FTL表字下标, 对应扇区 data_start + region * 32 起最多32个扇区
+ * */
+static void ICACHE_FLASH_ATTR ftl_region_load(spifs_t *fs, uint32_t region) {
+	uint32_t i, first, last, readIn;
+#ifdef SPIFS_USE_WEAR_LEVELING
+	uint32_t most = 0;
+#endif
+
+	if(BITMAP_GET(fs->ftl_loaded, region)) {
+		return;
+	}
+	first = (region * BITS_OF_INTEGER);
+	last = ((first + BITS_OF_INTEGER) < fs->data_sectors) ? (first + BITS_OF_INTEGER) : fs->data_sectors;
+	for(i = first; i < last; i++) {
+		// LSB      MSB
+		spifs_flash_read(fs, ((fs->data_start + i) * SECTOR_SIZE), &readIn, sizeof(uint32_t));
+
+		// AA FF FF FF 标记为废弃扇区, 标记字损坏时同样按废弃扇区处理, 擦除后才可写
+		if(!((readIn >> 4) & 0x1)) {
+			BITMAP_SET(fs->ftl_erasable.map, i);
+		}
+		// FF FF FF FF 空扇区
+		else if(readIn & 0x1) {
+			BITMAP_SET(fs->ftl_writable.map, i);
+		}
+#ifdef SPIFS_USE_WEAR_LEVELING
+		// 高24位擦除次数, 全1表示未记录
+		readIn >>= SECTOR_WEAR_SHIFT;
+		fs->erase_count[i] = (readIn > SECTOR_WEAR_MAX) ? EMPTY_INT_VALUE : readIn;
+		if(readIn <= SECTOR_WEAR_MAX && readIn > most) {
+			most = readIn;
+		}
+#endif
+	}
+#ifdef SPIFS_USE_WEAR_LEVELING
+	for(i = first; i < last; i++) {
+		if(fs->erase_count[i] == EMPTY_INT_VALUE) {
+			fs->erase_count[i] = most;
+		}
+		if(BITMAP_GET(fs->ftl_erasable.map, i) && (fs->erase_count[i] < fs->ftl_erasable.least)) {
+			fs->ftl_erasable.least = fs->erase_count[i];
+		}
+		if(BITMAP_GET(fs->ftl_writable.map, i) && (fs->erase_count[i] < fs->ftl_writable.least)) {
+			fs->ftl_writable.least = fs->erase_count[i];
+		}
+	}
+#endif
+	fs->ftl_erasable.count += bitmap_popcount(&fs->ftl_erasable.map[region], 1);
+	fs->ftl_writable.count += bitmap_popcount(&fs->ftl_writable.map[region], 1);
+	BITMAP_SET(fs->ftl_loaded, region);
+	fs->ftl_pending--;
+}
+
+/**
+ * @brief 载入全部未载入的FTL区域, 用于需要整个数据区状态的空间查询/GC/检查点
+ * */
+static void ICACHE_FLASH_ATTR ftl_load_all(spifs_t *fs) {
+	uint32_t region;
+
+	for(region = 0; (region < fs->ftl_words) && (fs->ftl_pending > 0); region++) {
+		ftl_region_load(fs, region);
+	}
+}
+
+/**
+ * @brief 按区域载入FTL表, 直到空白扇区不少于nums或全部载入, 从分配游标所在区域开始
+ * @param nums 需要的空白扇区数量
+ * */
+static void ICACHE_FLASH_ATTR ftl_load_writable(spifs_t *fs, uint32_t nums) {
+	uint32_t i, region = 0;
+
+#ifdef SPIFS_USE_WEAR_LEVELING
+	region = ((fs->alloc_cursor - fs->data_start) / BITS_OF_INTEGER);
+#endif
+	for(i = 0; (i < fs->ftl_words) && (fs->ftl_pending > 0) && (fs->ftl_writable.count < nums); i++) {
+		ftl_region_load(fs, region);
+		region = ((region + 1) < fs->ftl_words) ? (region + 1) : 0;
+	}
+}
+
+/**
+ * @brief 延迟挂载时建立文件索引区RAM索引
+ * */
+static void ICACHE_FLASH_ATTR spifs_fb_ensure(spifs_t *fs) {
+	if(fs->fb_pending) {
+		spifs_fb_scan(fs);
+	}
+}
+
+/**
+ * @brief 扫描文件索引区, 建立文件块RAM索引
+ * */
+static void ICACHE_FLASH_ATTR spifs_fb_scan(spifs_t *fs) {
+#if defined(SPIFS_USE_FB_INDEX) || defined(SPIFS_USE_FB_SLOTMAP)
+	uint32_t slot, i, n = 0;
+	uint32_t fb_buffer[FB_SCAN_SLOTS * FILEBLOCK_SIZE / sizeof(uint32_t)];
+	FileBlock *fb;
+
+	fs->fb_pending = FALSE;
+#ifdef SPIFS_USE_FB_INDEX
+	fb_index_reset(fs);
+#endif
+#ifdef SPIFS_USE_FB_SLOTMAP
+	fb_slots_reset(fs);
+#endif
+	for(slot = 0, i = 0; slot < fs->fb_slots; slot++, i++) {
+		// 窗口用尽时突发读取同一扇区内的后续文件块
+		if(i == n) {
+			n = (FB_SLOTS_PER_SECTOR - (slot % FB_SLOTS_PER_SECTOR));
+			n = (n < FB_SCAN_SLOTS) ? n : FB_SCAN_SLOTS;
+			spifs_flash_read(fs, fb_slot_addr(fs, slot), fb_buffer, (n * FILEBLOCK_SIZE));
+			i = 0;
+		}
+		fb = (FileBlock *)(fb_buffer + i * (FILEBLOCK_SIZE / sizeof(uint32_t)));
+		if(!fb_has_name((uint8_t *)fb)) {
+			continue;
+		}
+		if(fb->info.state.del & fb->info.state.dep) {
+#ifdef SPIFS_USE_FB_INDEX
+			fb_index_insert(fs, fb_slot_addr(fs, slot), fb->filename);
+#endif
+#ifdef SPIFS_USE_FB_SLOTMAP
+			fb_slots_set(fs, slot, FB_SLOT_LIVE);
+#endif
+		}else {
+#ifdef SPIFS_USE_FB_SLOTMAP
+			fb_slots_set(fs, slot, FB_SLOT_DEAD);
+#endif
+		}
+	}
+#endif
+}
+
+/**
+ * @brief 标记文件块删除/失效并同步RAM索引
+ * @param *file 文件指针, file->filename/extname需与文件块记录一致
+ * @param fstate FSTATE_DELETE or FSTATE_DEPRECATE
+ * */
+static void ICACHE_FLASH_ATTR fileblock_retire(spifs_t *fs, File *file, uint8_t fstate) {
+	write_fileblock_state(fs, file->block, fstate);
+#ifdef SPIFS_USE_FB_INDEX
+	fb_index_remove(fs, file->block, file->filename);
+#endif
+#ifdef SPIFS_USE_FB_SLOTMAP
+	fb_slots_set(fs, fb_slot_index(fs, file->block), FB_SLOT_DEAD);
+#endif
+}
+
+/**
+ * @brief 标记FTL表, 位变化时同步置位数量, 扇区所在区域未载入时忽略
+ * @param position 扇区编号 fs->data_start~fs->data_end
+ * @param bitValue only 0 or 1
+ * */
+static void spifs_ftl_mark(spifs_t *fs, FtlTable *table, uint32_t position, uint32_t bitValue) {
+	position -= fs->data_start;
+	// 未载入区域以flash扇区标记字为准, 载入时读取
+	if(!BITMAP_GET(fs->ftl_loaded, (position / BITS_OF_INTEGER))) {
+		return;
+	}
+	if(BITMAP_GET(table->map, position) == bitValue) {
+		return;
+	}
+#ifdef SPIFS_USE_CHECKPOINT
+	ckpt_touch(fs);
+#endif
+	if(bitValue) {
+		BITMAP_SET(table->map, position);
+		table->count++;
+#ifdef SPIFS_USE_WEAR_LEVELING
+		if(fs->erase_count[position] < table->least) {
+			table->least = fs->erase_count[position];
+		}
+#endif
+	}else {
+		BITMAP_CLEAR(table->map, position);
+		table->count--;
+	}
+}
+
+/**
+ * @brief 清空FTL表, 全部区域标记为未载入
+ * */
+static void ICACHE_FLASH_ATTR ftl_clear(spifs_t *fs) {
+	os_memset(fs->ftl_erasable.map, 0x00, fs->ftl_words * sizeof(uint32_t));
+	os_memset(fs->ftl_writable.map, 0x00, fs->ftl_words * sizeof(uint32_t));
+	os_memset(fs->ftl_loaded, 0x00, BITMAP_WORDS(fs->ftl_words) * sizeof(uint32_t));
+	fs->ftl_erasable.count = 0;
+	fs->ftl_writable.count = 0;
+#ifdef SPIFS_USE_WEAR_LEVELING
+	fs->ftl_erasable.least = EMPTY_INT_VALUE;
+	fs->ftl_writable.least = EMPTY_INT_VALUE;
+#endif
+	fs->ftl_pending = fs->ftl_words;
+}
+
+/**
+ * @brief spifs垃圾回收
+ * @brief 应用层的删除文件操作并不会从闪存中擦除文件数据, 而是标记其文件块的状态属性为可删除文件
+ * @param tp GC类型，GC_TYPE_FILEBLOCK：仅扫描文件索被标记删除/失效/无cluster的item
+ * 					GC_TYPE_DATAAREA：仅扫描数据区被标记废弃的扇区
+ * 					GC_TYPE_MAJOR：Full GC
+ * @param nums 期望GC后回收的数量
+ * @return  返回实际回收的数量
+ * 			对于GC_TYPE_FILEBLOCK，返回值通常 >= nums
+ * 			对于GC_TYPE_DATAAREA，返回值 == nums
+ * 			对于GC_TYPE_MAJOR，返回值 = FILEBLOCK回收数量+DATAAREA回收数量
+ * */
+uint32_t ICACHE_FLASH_ATTR spifs_gc(spifs_t *fs, GCType tp, uint32_t nums) {
+    API_ENTER(SPIFS_API_GC, API_LOCK_WRITE);
+    return API_RETURN(gc_impl(fs, tp, nums));
+}
+
+/**
+ * @brief 垃圾回收实现, 创建文件时文件索引区空间不足也由此回收
+ * @param tp GC类型
+ * @param nums 期望GC后回收的数量
+ * @return 实际回收的数量
+ * */
+static uint32_t ICACHE_FLASH_ATTR gc_impl(spifs_t *fs, GCType tp, uint32_t nums) {
+    uint32_t fb_index, count = 0;
+    uint32_t pass, visited[BITMAP_WORDS(GC_FB_SECTORS_MAX)];
+
+    // 扫描文件索引表查找被标记文件
+    if(tp == GC_TYPE_FILEBLOCK || tp == GC_TYPE_MAJOR) {
+    	os_memset(visited, 0x00, sizeof(visited));
+
+    	for(pass = fs->fb_start; pass < (fs->fb_end + 1); pass++) {
+    		// 优先回收废弃槽位最多的扇区
+    		fb_index = gc_pick_fb_sector(fs, visited);
+    		count += gc_fileblock_sector(fs, fb_index);
+			if(tp == GC_TYPE_FILEBLOCK && count >= nums) {
+				// only fileblock and count more than nums
+				break;
+			}
+		}
+    }
+
+    // 扫描数据扇区, 查找标记为废弃扇区, 启用磨损均衡时优先擦除擦除次数少的扇区
+    if(tp == GC_TYPE_DATAAREA || tp == GC_TYPE_MAJOR) {
+    	count = (tp == GC_TYPE_DATAAREA) ? 0 : count;
+    	if(count < nums) {
+    		count += gc_data_sectors(fs, nums - count);
+    	}
+    }
+    return count;
+}
+
+/**
+ * @brief 增量垃圾回收, 单次调用最多执行budget次扇区擦除, 可在空闲循环中反复调用
+ * @brief 优先擦除数据区废弃扇区, 无废弃数据扇区时回收一个含废弃文件块的文件索引扇区(擦除1次)
+ * @param budget 本次允许的最大擦除次数
+ * @return 实际执行的擦除次数, 返回0表示已无可回收扇区
+ * */
+uint32_t ICACHE_FLASH_ATTR spifs_gc_step(spifs_t *fs, uint32_t budget) {
+    uint32_t sec, erased;
+    API_ENTER(SPIFS_API_GC_STEP, API_LOCK_WRITE);
+
+    erased = gc_data_sectors(fs, budget);
+    if(erased >= budget) {
+    	return API_RETURN(erased);
+    }
+    // 文件索引扇区回收需要整扇区擦除回写, 每次调用最多回收一个
+    for(sec = fs->fb_start; sec < (fs->fb_end + 1); sec++) {
+#ifdef SPIFS_USE_FB_SLOTMAP
+		if(fb_slots_ready(fs) && (fb_slots_dead_count(fs, sec) == 0)) {
+			continue;
+		}
+#endif
+		if(gc_fileblock_sector(fs, sec) > 0) {
+			erased++;
+			break;
+		}
+    }
+    return API_RETURN(erased);
+}
+
+/**
+ * @brief 查询等待回收的扇区数量
+ * @brief 包括数据区废弃扇区和含废弃文件块的文件索引扇区, 未启用槽位状态表时仅统计数据区
+ * @return 待回收扇区数量, 即spifs_gc_step完成全部回收所需的擦除次数
+ * */
+uint32_t ICACHE_FLASH_ATTR spifs_gc_pending(spifs_t *fs) {
+    uint32_t pending;
+#ifdef SPIFS_USE_FB_SLOTMAP
+    uint32_t sec;
+#endif
+    LOCK_ENTER(API_LOCK_WRITE);
+
+    ftl_load_all(fs);
+    pending = fs->ftl_erasable.count;
+#ifdef SPIFS_USE_FB_SLOTMAP
+    spifs_fb_ensure(fs);
+
+    if(fb_slots_ready(fs)) {
+    	for(sec = fs->fb_start; sec < (fs->fb_end + 1); sec++) {
+    		pending += (fb_slots_dead_count(fs, sec) > 0);
+    	}
+    }
+#endif
+    return LOCK_RETURN(pending);
+}
+
+/**
+ * @brief 擦除最多nums个数据区废弃扇区, 启用磨损均衡时优先擦除擦除次数少的扇区
+ * @param nums 期望擦除的数量
+ * @return 实际擦除的数量
+ * */
+static uint32_t ICACHE_FLASH_ATTR gc_data_sectors(spifs_t *fs, uint32_t nums) {
+    uint32_t i, picked, count = 0;
+    uint32_t pick_list[GC_PICK_BATCH];
+
+	ftl_load_all(fs);
+	count = gc_data_blocks(fs, nums);
+	while(count < nums) {
+		picked = ((nums - count) < GC_PICK_BATCH) ? (nums - count) : GC_PICK_BATCH;
+#ifdef SPIFS_USE_WEAR_LEVELING
+		picked = ftl_pick(fs, &fs->ftl_erasable, pick_list, picked, &fs->gc_cursor);
+#else
+		picked = ftl_pick(fs, &fs->ftl_erasable, pick_list, picked, NULL);
+#endif
+		if(picked == 0) {
+			break;
+		}
+		for(i = 0; i < picked; i++) {
+			data_sector_erase(fs, pick_list[i]);
+		}
+		count += picked;
+	}
+	return count;
+}
+
+/**
+ * @brief 块擦除数据区中全部扇区均可擦除的对齐整块, 先64KB块后32KB块, 剩余扇区由gc_data_sectors逐个擦除
+ * @brief 启用磨损均衡时跳过含擦除次数 > (可擦除扇区最小值 + SPIFS_WEAR_THRESHOLD)扇区的块, 这些扇区按磨损顺序逐个擦除
+ * @param nums 最多擦除的扇区数
+ * @return 实际擦除的扇区数
+ * */
+static uint32_t ICACHE_FLASH_ATTR gc_data_blocks(spifs_t *fs, uint32_t nums) {
+    uint32_t secs, sec, bit, count = 0;
+#ifdef SPIFS_USE_WEAR_LEVELING
+    uint32_t limit;
+#endif
+
+	if((fs->ops->erase_block == NULL) || (fs->ftl_erasable.count < SPI_FLASH_BLOCK32_SECS)) {
+		return 0;
+	}
+#ifdef SPIFS_USE_ERASE_RESERVE
+	// 后台擦除中的扇区不可擦除, 其所在块不会被选中
+	reserve_finish(fs);
+#endif
+#ifdef SPIFS_USE_WEAR_LEVELING
+	// 下界可能偏低, 仅使块擦除条件更严格
+	limit = (fs->ftl_erasable.least + SPIFS_WEAR_THRESHOLD);
+#endif
+	for(secs = SPI_FLASH_BLOCK64_SECS; secs >= SPI_FLASH_BLOCK32_SECS; secs /= 2) {
+		sec = ((fs->data_start + secs - 1) / secs) * secs;
+		for(; ((sec + secs - 1) <= fs->data_end) && ((count + secs) <= nums); sec += secs) {
+			for(bit = (sec - fs->data_start); bit < (sec - fs->data_start + secs); bit++) {
+				if(!BITMAP_GET(fs->ftl_erasable.map, bit)) {
+					break;
+				}
+#ifdef SPIFS_USE_WEAR_LEVELING
+				if(fs->erase_count[bit] > limit) {
+					break;
+				}
+#endif
+			}
+			if(bit == (sec - fs->data_start + secs)) {
+				data_run_erase(fs, sec, (sec + secs - 1));
+				count += secs;
+			}
+		}
+	}
+	return count;
+}
+
+/**
+ * @brief 回收单个文件索引扇区中被标记删除/失效/无cluster的文件块, 在回收缓冲区内整扇区处理, 有回收时擦除并回写扇区
+ * @param sec 文件索引扇区编号
+ * @return 回收的文件块数量
+ * */
+static uint32_t ICACHE_FLASH_ATTR gc_fileblock_sector(spifs_t *fs, uint32_t sec) {
+	uint32_t count;
+
+	spifs_flash_read(fs, (sec * SECTOR_SIZE), (uint32_t *)fs->gc_buffer, SECTOR_SIZE);
+	count = gc_fileblock_slots(fs, sec, 0, fs->gc_buffer, GC_FB_SLOTS_SIZE);
+	// 擦除文件索引扇区，回写新文件索引表
+	if(count > 0) {
+		spifs_flash_erase(fs, sec);
+		spifs_flash_write(fs, sec * SECTOR_SIZE, (uint32_t *)fs->gc_buffer, SECTOR_SIZE);
+	}
+	return count;
+}
+
+/**
+ * @brief 清除文件索引扇区中一段文件块里的可回收文件块(被标记删除/失效/无cluster)并更新RAM索引
+ * @param sec 文件索引扇区编号
+ * @param offset 缓冲区首字节在扇区内的偏移, 文件块大小整数倍
+ * @param *buffer 文件块数据
+ * @param size 缓冲区长度, 文件块大小整数倍
+ * @return 回收的文件块数量
+ * */
+static uint32_t ICACHE_FLASH_ATTR gc_fileblock_slots(spifs_t *fs, uint32_t sec, uint32_t offset, uint8_t *buffer, uint32_t size) {
+    FileBlock *fb = NULL;
+    uint8_t slot_buffer[FILEBLOCK_SIZE];
+    uint32_t pos, count = 0;
+
+	for(pos = 0; (size - pos) >= FILEBLOCK_SIZE; pos += FILEBLOCK_SIZE) {
+		os_memcpy(slot_buffer, (buffer + pos), FILEBLOCK_SIZE);
+
+		if(!fb_has_name(slot_buffer)) {
+			continue;
+		}
+
+		fb = (FileBlock *)slot_buffer;
+		// 文件被标识为删除/标记为失效/创建文件但未填充数据, 清除文件索引信息
+		if(((fb->info.state.del) != FILE_STATE_MARKED) && ((fb->info.state.dep) != FILE_STATE_MARKED)
+				&& (fb->cluster != EMPTY_INT_VALUE)) {
+			continue;
+		}
+		count++;
+#ifdef SPIFS_USE_FB_INDEX
+		if(((fb->info.state.del) != FILE_STATE_MARKED) && ((fb->info.state.dep) != FILE_STATE_MARKED)) {
+			// 空文件索引仍在RAM索引中
+			fb_index_remove(fs, (sec * SECTOR_SIZE + offset + pos), slot_buffer);
+		}
+#endif
+		clear_fileblock(buffer, pos);
+#ifdef SPIFS_USE_FB_SLOTMAP
+		fb_slots_set(fs, fb_slot_index(fs, sec * SECTOR_SIZE + offset + pos), FB_SLOT_FREE);
+#endif
+	}
+	return count;
+}
+
+/**
+ * @brief 选择下一个待回收的文件索引扇区, 废弃槽位多的扇区优先, 数量相同时扇区号小的优先
+ * @brief 未启用槽位状态表时按扇区号升序
+ * @param *visited 已访问扇区位图, bit0对应fs->fb_start
+ * @return 扇区编号
+ * */
+static uint32_t ICACHE_FLASH_ATTR gc_pick_fb_sector(spifs_t *fs, uint32_t *visited) {
+	uint32_t sec, bit, pick = EMPTY_INT_VALUE, dead, most = 0;
+
+	for(sec = fs->fb_start; sec < (fs->fb_end + 1); sec++) {
+		bit = (sec - fs->fb_start);
+		if((visited[bit / BITS_OF_INTEGER] >> (bit % BITS_OF_INTEGER)) & 0x1) {
+			continue;
+		}
+#ifdef SPIFS_USE_FB_SLOTMAP
+		dead = fb_slots_ready(fs) ? fb_slots_dead_count(fs, sec) : 0;
+#else
+		dead = 0;
+#endif
+		if((pick == EMPTY_INT_VALUE) || (dead > most)) {
+			pick = sec;
+			most = dead;
+		}
+	}
+	bit = (pick - fs->fb_start);
+	visited[bit / BITS_OF_INTEGER] |= ((uint32_t)0x1 << (bit % BITS_OF_INTEGER));
+	return pick;
+}
+
+/**
+ * @brief 文件系统格式化
+ * @brief 仅擦除文件索引块区/数据区扇区，擦除完成后为0xFF
+ * */
+void ICACHE_FLASH_ATTR spifs_format(spifs_t *fs) {
+	API_ENTER(SPIFS_API_FORMAT, API_LOCK_WRITE);
+#ifdef SPIFS_USE_CHECKPOINT
+	// 旧检查点与格式化后的分区不一致, 头部位于首个扇区, 擦除首个扇区即可使其失效
+	if(fs->ckpt_sector != EMPTY_INT_VALUE) {
+		spifs_flash_erase(fs, fs->ckpt_sector);
+	}
+	fs->ckpt_clean = FALSE;
+#endif
+	// 擦除文件索引块扇区
+	flash_erase_run(fs, fs->fb_start, fs->fb_end);
+#ifdef SPIFS_USE_FB_INDEX
+	fb_index_reset(fs);
+#endif
+#ifdef SPIFS_USE_FB_SLOTMAP
+	fb_slots_reset(fs);
+#endif
+	fs->fb_pending = FALSE;
+	// 擦除数据区扇区, 未挂载时先载入区域读出擦除次数, 格式化不丢失磨损记录
+	data_run_erase(fs, fs->data_start, fs->data_end);
+	fs->ftl_valid = TRUE;
+	API_LEAVE();
+}
+
+/**
+ * @brief 写入FTL检查点, 下次挂载时spifs_ftl_init直接载入FTL表, 可在空闲时周期调用
+ * @brief 检查点有效(挂载或上次写入后FTL未修改)时不重复擦写检查点扇区
+ * @return 检查点有效TRUE, 未启用/未配置检查点扇区或未挂载FALSE
+ * */
+BOOL ICACHE_FLASH_ATTR spifs_checkpoint(spifs_t *fs) {
+#ifdef SPIFS_USE_CHECKPOINT
+	API_ENTER(SPIFS_API_CHECKPOINT, API_LOCK_WRITE);
+	if(!fs->ftl_valid) {
+		return API_RETURN(FALSE);
+	}
+	// 后台擦除完成后FTL表才确定
+	reserve_finish(fs);
+	if(fs->ckpt_clean) {
+		return API_RETURN(TRUE);
+	}
+	ftl_load_all(fs);
+	return API_RETURN(ckpt_save(fs));
+#else
+	return FALSE;
+#endif
+}
+
+/**
+ * @brief 效果等同于spifs_format
+ * @note spifs_erase_sector一次只擦除一个扇区，适用于不能阻塞CPU的场合
+ * @param sec 扇区编号 fs->fb_start~fs->fb_end or fs->data_start~fs->data_end
+ * */
+BOOL ICACHE_FLASH_ATTR spifs_erase_sector(spifs_t *fs, uint32_t sec) {
+#ifdef SPIFS_USE_FB_SLOTMAP
+	uint32_t i;
+#endif
+	LOCK_ENTER(API_LOCK_WRITE);
+	sec &= 0xFFFF;
+	if((sec >= fs->fb_start) && (sec < fs->fb_end + 1)) {
+#ifdef SPIFS_USE_FB_INDEX
+		fb_index_drop_sector(fs, sec);
+#endif
+#ifdef SPIFS_USE_FB_SLOTMAP
+		for(i = 0; i < FB_SLOTS_PER_SECTOR; i++) {
+			fb_slots_set(fs, ((sec - fs->fb_start) * FB_SLOTS_PER_SECTOR + i), FB_SLOT_FREE);
+		}
+#endif
+		spifs_flash_erase(fs, sec);
+		return LOCK_RETURN(TRUE);
+	}
+	if((sec >= fs->data_start) && (sec < fs->data_end + 1)) {
+		data_sector_erase(fs, sec);
+		return LOCK_RETURN(TRUE);
+	}
+	return LOCK_RETURN(FALSE);
+}
+
+/**
+ * @brief 查询flash数据区可用扇区数量
+ * @return 空闲的扇区
+ * */
+uint32_t ICACHE_FLASH_ATTR spifs_avail_sector(spifs_t *fs) {
+    uint32_t avail;
+    LOCK_ENTER(API_LOCK_WRITE);
+
+    ftl_load_all(fs);
+    // SECTOR_DISCARD_FLAG & EMPTY_INT_VALUE都认为是空闲扇区, 两表互斥
+    avail = (fs->ftl_erasable.count + fs->ftl_writable.count);
+#ifdef SPIFS_USE_ERASE_RESERVE
+    if(fs->reserve_sector != EMPTY_INT_VALUE) {
+    	// 后台擦除中的扇区
+    	avail++;
+    }
+#endif
+    return LOCK_RETURN(avail);
 }
 
 /**
  * @brief 查询flash文件索引区还能创建的文件数量
  * @return 文件索引区可创建文件数量
  * */
-uint32_t ICACHE_FLASH_ATTR spifs_avail_files() {
+uint32_t ICACHE_FLASH_ATTR spifs_avail_files(spifs_t *fs) {
+    LOCK_ENTER(API_LOCK_WRITE);
+    return LOCK_RETURN(avail_files_impl(fs));
+}
+
+/**
+ * @brief 查询可创建文件数量实现, 延迟挂载时先建立文件索引区RAM索引
+ * @return 文件索引区可创建文件数量
+ * */
+static uint32_t ICACHE_FLASH_ATTR avail_files_impl(spifs_t *fs) {
     uint32_t sec_index, addr_start, addr_end, avail = 0;
     uint8_t fb_buffer[FILENAME_FULLSIZE];
 
-    for(sec_index = FB_SECTOR_START; sec_index < (FB_SECTOR_END + 1); sec_index++) {
+    spifs_fb_ensure(fs);
+#ifdef SPIFS_USE_FB_SLOTMAP
+    if(fb_slots_ready(fs)) {
+        return fb_slots_free_count(fs);
+    }
+#endif
+
+    for(sec_index = fs->fb_start; sec_index < (fs->fb_end + 1); sec_index++) {
 
     	addr_start = sec_index * SECTOR_SIZE;
         addr_end = (addr_start + SECTOR_SIZE);
 
         while((addr_end - addr_start) >= FILEBLOCK_SIZE) {
 
-            spi_flash_read(addr_start, (uint32_t *)fb_buffer, FILENAME_FULLSIZE);
+            spifs_flash_read(fs, addr_start, (uint32_t *)fb_buffer, FILENAME_FULLSIZE);
 
             if(!fb_has_name(fb_buffer)) {
                 avail++;
@@ -71,6 +71,19 @@ typedef struct _file_block {
     FileInfo info;   // 文件信息
 } FileBlock;
 
+/**
+ * @brief 文件簇链缓存, 记录簇链中每隔interval个扇区的扇区首地址
+ * @brief 由调用者分配, 通过attach_cluster_cache挂载到FileHandle, 首次遍历簇链时按需填充
+ * @brief sectors[k]为第(k * interval)个扇区首地址, interval = 1时为完整缓存
+ */
+typedef struct _cluster_cache {
+    uint32_t cluster;   // 缓存对应的文件首簇地址, 与File.cluster不一致时缓存失效
+    uint32_t *sectors;  // 扇区首地址表
+    uint16_t capacity;  // 扇区首地址表容量
+    uint16_t interval;  // 采样间隔(扇区数)
+    uint16_t filled;    // 已填充数量
+} ClusterCache;
+
 // 文件信息结构(24字节)
 typedef struct _file {
     uint8_t filename[8]; // 文件名
@@ -80,6 +93,46 @@ typedef struct _file {
     uint32_t length; // 文件大小
 } File;
 
+/**
+ * @brief 文件列表游标, 由list_file_filter更新, 调用者不应解析其内容
+ * @brief 游标记录文件索引区槽位位置, 文件索引区GC不移动文件块, 期间创建/删除文件不影响已返回部分
+ */
+typedef struct _spifs_list_cursor {
+    uint32_t position;
+} SpifsListCursor;
+
+// 游标初始值, 从文件索引区起始位置列出
+#define SPIFS_LIST_BEGIN      (0)
+// 游标结束值, 已列出全部文件
+#define SPIFS_LIST_END        (EMPTY_INT_VALUE)
+
+/**
+ * @brief 文件列表过滤条件, 全部条件满足时输出, 默认值(NULL/FSTATE_DEFAULT/0)表示不限制
+ */
+typedef struct _spifs_list_filter {
+    const char *extname;    // 拓展名, 完整匹配, NULL:不限
+    const char *prefix;     // 文件名前缀, NULL:不限
+    uint8_t fstate;         // 必须置位的状态字, 与make_finfo相同, 如FSTATE_SYSTEM & FSTATE_READONLY
+    uint32_t min_length;    // 最小文件大小(字节)
+    uint32_t max_length;    // 最大文件大小(字节), 0:不限
+} SpifsListFilter;
+
+/**
+ * @brief 分散/聚集缓冲区段, 用于read_file_v/write_file_v
+ */
+typedef struct _spifs_iovec {
+    uint8_t *base;      // 段起始地址, 无需4字节对齐
+    uint32_t length;    // 段长度(字节), 可为0
+} SpifsIovec;
+
+/**
+ * @brief 内存映射只读数据段, 由map_file返回, 每段位于同一扇区数据区内
+ */
+typedef struct _spifs_span {
+    const uint8_t *data;
+    uint32_t length;
+} SpifsSpan;
+
 /**
  * @brief 文件操作结果码
  */
@@ -111,9 +164,41 @@ typedef enum _result {
     // 文件超出长度
     FILENAME_OUT_OF_BOUNDS,
     // 文件重命名成功
-    FILE_RENAME_SUCCESS
+    FILE_RENAME_SUCCESS,
+
+    // 写入范围超出文件长度
+    FILE_OFFSET_OUT_OF_BOUNDS
 } Result;
 
+/**
+ * @brief flash操作统计槽位(SPIFS_USE_STATS), 每个API的flash操作计入对应槽位
+ * @brief 嵌套调用(如write_finish内部调用create_file)计入最外层API
+ */
+typedef enum _spifs_api {
+    // 不属于任何API的操作
+    SPIFS_API_NONE = 0,
+    SPIFS_API_CREATE_FILE,
+    SPIFS_API_WRITE_FILE,
+    SPIFS_API_WRITE_FINISH,
+    SPIFS_API_READ_FILE,
+    SPIFS_API_OPEN_FILE,
+    SPIFS_API_RENAME_FILE,
+    SPIFS_API_LIST_FILE,
+    SPIFS_API_DELETE_FILE,
+    SPIFS_API_OPEN_HANDLE,
+    SPIFS_API_READ_HANDLE,
+    SPIFS_API_WRITE_HANDLE,
+    SPIFS_API_CLOSE_HANDLE,
+    SPIFS_API_GC,
+    SPIFS_API_GC_STEP,
+    SPIFS_API_RESERVE_STEP,
+    SPIFS_API_FTL_INIT,
+    SPIFS_API_FORMAT,
+    SPIFS_API_CHECKPOINT,
+    SPIFS_API_MAP_FILE,
+    SPIFS_API_COUNT
+} SpifsApi;
+
 typedef enum _gc_type {
 	GC_TYPE_FILEBLOCK = 0,
 	GC_TYPE_DATAAREA,
@@ -130,7 +215,32 @@ typedef enum _write_method {
     APPEND
 }WriteMethod;
 
-#include "diskio.h"
+/**
+ * @brief 文件句柄打开方式, 可组合使用
+ */
+typedef enum _handle_mode {
+    // 读取, 要求文件未被标记删除/失效
+    HANDLE_READ = 0x1,
+    // 追加写, 另要求文件非只读
+    HANDLE_WRITE = 0x2,
+    HANDLE_READ_WRITE = 0x3
+} HandleMode;
+
+/**
+ * @brief 文件句柄, 在File基础上缓存文件信息、尾扇区与读写位置
+ * @brief 打开期间不再重复读取文件信息, 追加写无需遍历簇链, 顺序读从上次所在扇区继续
+ */
+typedef struct _file_handle {
+    File file;             // 文件, write_finish后文件块地址可能变化
+    FileInfo finfo;        // 打开时读取的文件信息
+    uint32_t tail;         // 最后一个扇区首地址, EMPTY_INT_VALUE:未知或空文件
+    uint32_t position;     // 读写位置
+    uint32_t sector;       // 最近读取的扇区首地址, EMPTY_INT_VALUE:未知
+    uint32_t sector_index; // 最近读取的扇区在簇链中的序号
+    uint8_t mode;          // HandleMode
+    uint8_t dirty;         // 追加写后尚未更新文件索引块中的文件大小
+    ClusterCache *cache;   // 簇链缓存, 可为NULL, 由attach_cluster_cache设置
+} FileHandle;
 
 /**
  * 文件簇大小 = 扇区大小 = 4KB
@@ -139,6 +249,62 @@ typedef enum _write_method {
 // 使用空指针检查
 #define SPIFS_USE_NULL_CHECK
 
+// 使用文件索引区RAM哈希索引, 打开/创建文件时无需扫描整个文件索引区
+// RAM占用: FB_HASH_BUCKETS * 2 + 文件块总数 * 3 字节
+#define SPIFS_USE_FB_INDEX
+
+// 使用文件块槽位状态表(空闲/有效/废弃), 空闲槽位查找与可用文件数查询无需读取flash
+// RAM占用: 文件块总数 / 4 字节
+#define SPIFS_USE_FB_SLOTMAP
+
+// 使用数据区动态磨损均衡, 记录每个数据扇区擦除次数, 分配/回收时优先选择擦除次数少的扇区
+// 擦除次数随使用中/废弃标记保存在扇区标记字高24位(空白扇区不记录, 由检查点保存), RAM占用: 数据区扇区数 * 4 字节
+#define SPIFS_USE_WEAR_LEVELING
+// 擦除次数不超过(最小值 + SPIFS_WEAR_THRESHOLD)的扇区优先分配
+#define SPIFS_WEAR_THRESHOLD    (16)
+
+// 使用预擦除扇区储备, 由spifs_reserve_step在定时器/空闲回调中以非阻塞方式擦除废弃扇区
+#define SPIFS_USE_ERASE_RESERVE
+// 默认空白扇区低水位, 空白扇区少于该值时开始预擦除
+#define SPIFS_RESERVE_SECTORS   (16)
+
+// 使用FTL检查点, 将FTL表与擦除次数保存到独立扇区, 挂载时直接载入, 检查点失效时回退到全区扫描
+// 检查点在spifs_checkpoint/spifs_unmount时写入, 此后首次修改FTL时标记失效
+#define SPIFS_USE_CHECKPOINT
+// 默认检查点扇区, 检查点自该扇区起占用ckpt_sectors(数据区扇区数)个连续扇区(每扇区约1300个数据区扇区), 不能与文件索引区/数据区重叠
+#define SPIFS_CHECKPOINT_SECTOR (1019)
+
+// 使用读写锁接口, 多任务并发访问同一实例: 只读API(打开/读取/列出文件)持读锁并发执行, 其余API持写锁独占执行
+// 锁由SpifsConfig.lock_ops提供, 为NULL时不加锁; RTOS仅有互斥量时读锁/写锁可使用同一互斥量
+// spifs_init/spifs_mount/spifs_unmount不加锁, 需在其他任务访问实例之前/之后调用; 启用SPIFS_USE_STATS时全部API持写锁
+#define SPIFS_USE_LOCK
+
+// 使用异步请求队列(spifs_async.c), 读写/GC请求提交后立即返回, 由后端执行上下文执行, 完成后回调或查询状态
+#define SPIFS_USE_ASYNC
+
+// 使用flash内存映射只读访问(map_file), 文件数据以指针+长度段返回, 无需复制到RAM缓冲区
+// 映射基址由SpifsConfig.mmap_base提供(XIP映射地址或模拟器w25q32_getbuffer()), 为NULL时map_file返回0
+#define SPIFS_USE_MMAP
+
+// 使用flash读缓存(cache.c), 文件索引区整区常驻RAM, 可选数据页LRU缓存, 写入直写flash并同步更新缓存
+// 大小由SpifsConfig.cache_fb/cache_pages配置, 命中统计由spifs_cache_stats读取
+// 多任务访问时缓存由SpifsLockOps.mutex_lock保护, 只读API仍并发执行; 锁接口未提供mutex_lock时只读API升级为写锁
+#define SPIFS_USE_CACHE
+
+// 使用flash操作统计, 按API分别记录本实例的flash读/写/擦除次数与字节数, 由spifs_stats_snapshot读取
+// 默认关闭, 由编译选项-DSPIFS_USE_STATS启用, RAM占用: SPIFS_API_COUNT * 28 字节
+// #define SPIFS_USE_STATS
+
+// 写文件与GC路径不分配堆内存, 工作内存峰值固定, 与文件长度/文件索引区大小无关
+// 写文件按批取出空闲扇区, 栈占用: SPIFS_WRITE_BATCH_SECTORS * 4 + 页暂存区(PAGE_SIZE + 12) 字节
+#define SPIFS_WRITE_BATCH_SECTORS    (16)
+// 文件索引扇区回收在回收缓冲区内整扇区处理, 缓冲区由SpifsConfig.gc_buffer提供或spifs_init分配一次(SECTOR_SIZE字节)
+// 栈占用: 52(已访问扇区位图) 字节
+// 随机偏移覆盖写从首簇遍历一次簇链, 缓存以末个受影响扇区结尾的一段扇区地址后向前处理, 向前复制越过窗口时重新遍历
+// 栈占用: (SPIFS_COW_WINDOW_SECTORS + 1) * 4 字节
+#define SPIFS_COW_WINDOW_SECTORS     (32)
+
+// 默认分区(spifs_default_config), 实际扇区范围由spifs_t运行时指定
 // 文件索引占用扇区号范围[FB_SECTOR_START ~ FB_SECTOR_END]
 #define FB_SECTOR_START     287
 #define FB_SECTOR_END       290
@@ -147,9 +313,7 @@ typedef enum _write_method {
 #define DATA_SECTOR_START   291
 #define DATA_SECTOR_END     1018
 
-// FTL表大小，实际字节数量 = 32 * sizeof(uint32_t)
-// 索引整个flash 1024个扇区
-#define FTL_SIZE          (32)
+// FTL表按数据区扇区数量在spifs_init时分配, 每个扇区1位
 #define FTL_MARK          (1)
 #define FTL_UNMARK        (0)
 
@@ -162,6 +326,10 @@ typedef enum _write_method {
 
 // 扇区使用中标记大小(字节)
 #define SECTOR_MARK_SIZE       4
+// 扇区标记字: 低8位为扇区状态, 高24位为扇区擦除次数(0xFFFFFF表示未记录)
+#define SECTOR_STATE_MASK      (0xFF)
+#define SECTOR_WEAR_SHIFT      (8)
+#define SECTOR_WEAR_MAX        (0xFFFFFE)
 // 扇区使用中标记
 #define SECTOR_INUSE_FLAG      (0xFFFFFFFA)
 // 扇区数据废弃标记
@@ -193,45 +361,306 @@ typedef enum _write_method {
 #define DAY_MINI_VALUE     1
 #define DAY_MAX_VALUE      31
 
+/**
+ * @brief flash操作接口, 不同芯片/多片flash各自提供实现
+ * @brief 地址为flash物理地址, 读写地址与长度4字节对齐, 缓冲区4字节对齐
+ */
+typedef struct _spifs_flash_ops {
+    SpiFlashOpResult (*read)(void *flash, uint32_t addr, uint32_t *buffer, uint32_t size);
+    SpiFlashOpResult (*write)(void *flash, uint32_t addr, uint32_t *buffer, uint32_t size);
+    // 阻塞擦除扇区, sec为扇区编号
+    SpiFlashOpResult (*erase)(void *flash, uint32_t sec);
+    // 发起扇区擦除后立即返回, 可为NULL, 为NULL时预擦除储备使用阻塞擦除
+    SpiFlashOpResult (*erase_start)(void *flash, uint32_t sec);
+    // 查询擦除是否进行中, erase_start为NULL时可为NULL
+    uint8_t (*busy)(void *flash);
+    // 阻塞块擦除, sec为块首扇区编号且按secs对齐, secs为SPI_FLASH_BLOCK32_SECS/SPI_FLASH_BLOCK64_SECS
+    // 可为NULL, 为NULL或返回失败时逐扇区擦除
+    SpiFlashOpResult (*erase_block)(void *flash, uint32_t sec, uint32_t secs);
+} SpifsFlashOps;
+
+/**
+ * @brief 读写锁接口, 由移植层实现, 主机测试可使用spifs_port_posix.c的pthread实现
+ * @brief 持读锁时多个任务可同时调用flash读操作, flash驱动需自行保证总线互斥
+ * @brief File/FileHandle/ClusterCache由调用者持有, 不受锁保护, 不能在任务间共享
+ * @brief mutex_lock/mutex_unlock为短时互斥锁, 保护持读锁期间仍会修改的读缓存, 不能与读写锁使用同一互斥量, 可为NULL
+ */
+typedef struct _spifs_lock_ops {
+    void (*read_lock)(void *lock);
+    void (*read_unlock)(void *lock);
+    void (*write_lock)(void *lock);
+    void (*write_unlock)(void *lock);
+    void (*mutex_lock)(void *lock);
+    void (*mutex_unlock)(void *lock);
+} SpifsLockOps;
+
+/**
+ * @brief 文件系统配置, 扇区编号为flash内扇区序号
+ * @brief 文件块槽位编号为16位, 文件索引区不超过385个扇区
+ */
+typedef struct _spifs_config {
+    uint32_t fb_start;             // 文件索引区首扇区
+    uint32_t fb_end;               // 文件索引区末扇区
+    uint32_t data_start;           // 数据区首扇区
+    uint32_t data_end;             // 数据区末扇区
+    uint32_t checkpoint_sector;    // FTL检查点首扇区, 数据区较大时占用多个连续扇区, 与分区重叠时spifs_init失败, EMPTY_INT_VALUE:不使用检查点
+    const SpifsFlashOps *ops;      // flash操作接口
+    void *flash;                   // 传给flash操作接口的芯片参数
+    BOOL lazy_mount;               // 延迟挂载, spifs_ftl_init不扫描, 首次需要时按区域载入FTL表、建立文件索引区RAM索引
+    const SpifsLockOps *lock_ops;  // 读写锁接口, NULL:不加锁, 仅单任务访问
+    void *lock;                    // 传给读写锁接口的锁对象, 需在spifs_init前创建
+    const uint8_t *mmap_base;      // flash地址0映射到的内存地址, NULL:不支持内存映射
+    BOOL cache_fb;                 // 缓存整个文件索引区, RAM占用为文件索引区大小
+    uint32_t cache_pages;          // 数据页缓存页数(每页256字节), 0:不缓存
+    uint8_t *gc_buffer;            // 文件索引扇区回收缓冲区, SECTOR_SIZE字节且4字节对齐, NULL:由spifs_init分配
+} SpifsConfig;
+
+/**
+ * @brief 读缓存统计, 按命中率确定缓存大小
+ */
+typedef struct _spifs_cache_stats {
+    // 文件索引区读取命中次数/未命中(载入扇区)次数
+    uint32_t fb_hits;
+    uint32_t fb_misses;
+    // 数据页读取命中次数/未命中(载入页)次数
+    uint32_t page_hits;
+    uint32_t page_misses;
+    // 跨页等未经缓存直接读取flash的次数
+    uint32_t bypass;
+} SpifsCacheStats;
+
+#ifdef SPIFS_USE_STATS
+/**
+ * @brief 单个API的flash操作统计, 计数为经SpifsFlashOps实际发出的操作
+ */
+typedef struct _spifs_flash_stats {
+    // API进入次数
+    uint32_t calls;
+    // 读操作次数/字节数
+    uint32_t reads;
+    uint32_t read_bytes;
+    // 写操作次数/字节数
+    uint32_t writes;
+    uint32_t write_bytes;
+    // 扇区擦除次数
+    uint32_t erases;
+    // 块擦除次数
+    uint32_t block_erases;
+} SpifsFlashStats;
+#endif
+
+/**
+ * @brief FTL表, 每个数据区扇区1位, 位0对应data_start, 同时维护置位数量
+ * @brief 启用磨损均衡时维护置位扇区擦除次数的下界: 置位时更新, 清位不更新, 选取时发现过期再修正
+ */
+typedef struct _ftl_table {
+    uint32_t *map;
+    uint32_t count;
+#ifdef SPIFS_USE_WEAR_LEVELING
+    uint32_t least;
+#endif
+} FtlTable;
+
+/**
+ * @brief 文件系统实例, 持有分区参数、flash操作接口及全部运行时状态
+ * @brief 多个实例可分别挂载同一flash的不同分区或不同flash
+ */
+typedef struct _spifs {
+    uint32_t fb_start;
+    uint32_t fb_end;
+    uint32_t data_start;
+    uint32_t data_end;
+    uint32_t fb_slots;             // 文件块总数
+    uint32_t data_sectors;         // 数据区扇区数
+    const SpifsFlashOps *ops;
+    void *flash;
+#ifdef SPIFS_USE_LOCK
+    const SpifsLockOps *lock_ops;
+    void *lock;
+#endif
+#ifdef SPIFS_USE_MMAP
+    const uint8_t *mmap_base;
+#endif
+#ifdef SPIFS_USE_CACHE
+    // 文件索引区扇区缓存/已载入扇区Bitmap, NULL:不缓存文件索引区
+    uint8_t *cache_fb;
+    uint32_t *cache_fb_valid;
+    // 数据页缓存: 页首地址/最近使用时刻/页数据, 见cache.c
+    uint32_t *cache_tag;
+    uint32_t *cache_stamp;
+    uint8_t *cache_data;
+    uint32_t cache_pages;
+    uint32_t cache_tick;
+    SpifsCacheStats cache_stats;
+#endif
+#ifdef SPIFS_USE_STATS
+    // 各API的flash操作统计, 下标为SpifsApi; 当前计入的API
+    SpifsFlashStats stats[SPIFS_API_COUNT];
+    uint32_t stats_api;
+#endif
+
+    // FTL可擦除扇区Bitmap表, 0:扇区不可擦除(空白扇区或带数据扇区), 1:扇区可擦除(标记为SECTOR_DISCARD_FLAG)
+    FtlTable ftl_erasable;
+    // FTL空白扇区Bitmap表, 0:扇区不是空白(带数据或标记为可擦除), 1:扇区空白(标记为EMPTY_INT_VALUE)
+    FtlTable ftl_writable;
+    // FTL表字数
+    uint32_t ftl_words;
+    // FTL表已由spifs_ftl_init/spifs_format建立
+    BOOL ftl_valid;
+    // FTL区域载入Bitmap, 每个FTL字(32个扇区)为一个区域, 1:已从flash载入, 未载入区域在FTL表中全为0
+    uint32_t *ftl_loaded;
+    // 未载入区域数量
+    uint32_t ftl_pending;
+    // 延迟挂载
+    BOOL lazy_mount;
+    // 延迟挂载时文件索引区RAM索引尚未建立
+    BOOL fb_pending;
+    // 文件索引扇区回收缓冲区, 由调用者提供或spifs_init分配
+    uint8_t *gc_buffer;
+    // 回收缓冲区由spifs_init分配, 卸载时释放
+    BOOL gc_buffer_owned;
+
+#ifdef SPIFS_USE_WEAR_LEVELING
+    // 数据区扇区擦除次数, 下标0对应data_start, 随FTL区域载入
+    uint32_t *erase_count;
+    // 空闲扇区分配游标/回收游标, 轮转查找避免总是使用低地址扇区
+    uint32_t alloc_cursor;
+    uint32_t gc_cursor;
+#endif
+
+#ifdef SPIFS_USE_ERASE_RESERVE
+    // 空白扇区低水位
+    uint32_t reserve_low_water;
+    // 正在后台擦除的扇区编号, EMPTY_INT_VALUE表示空闲
+    uint32_t reserve_sector;
+#endif
+
+#ifdef SPIFS_USE_CHECKPOINT
+    // 检查点首扇区, EMPTY_INT_VALUE表示不使用
+    uint32_t ckpt_sector;
+    // 最近一次检查点序号
+    uint32_t ckpt_seq;
+    // flash上的检查点与RAM中FTL表一致, 修改FTL前需先标记检查点失效
+    BOOL ckpt_clean;
+#endif
+
+#ifdef SPIFS_USE_FB_INDEX
+    // 哈希桶链表头/槽位链表后继/文件名哈希值高8位, 见fbindex.c
+    uint16_t *hash_head;
+    uint16_t *hash_next;
+    uint8_t *hash_tag;
+    BOOL index_valid;
+#endif
+
+#ifdef SPIFS_USE_FB_SLOTMAP
+    // 槽位占用/有效Bitmap, 各扇区废弃槽位计数, 见fbindex.c
+    uint32_t *slot_used;
+    uint32_t *slot_live;
+    uint16_t *slot_dead;
+    uint32_t free_slots;
+    BOOL slots_valid;
+#endif
+} spifs_t;
+
+#include "diskio.h"
+
+void ICACHE_FLASH_ATTR spifs_default_config(SpifsConfig *cfg);
+
+BOOL ICACHE_FLASH_ATTR spifs_init(spifs_t *fs, const SpifsConfig *cfg);
+
+BOOL ICACHE_FLASH_ATTR spifs_mount(spifs_t *fs, const SpifsConfig *cfg);
+
+void ICACHE_FLASH_ATTR spifs_unmount(spifs_t *fs);
+
 BOOL ICACHE_FLASH_ATTR make_file(File *file, char *filename, char *extname);
 
 BOOL ICACHE_FLASH_ATTR make_finfo(FileInfo *finfo, uint32_t year, uint8_t month, uint8_t day, uint8_t fstate);
 
-Result ICACHE_FLASH_ATTR create_file(File *file, FileInfo *finfo);
+Result ICACHE_FLASH_ATTR create_file(spifs_t *fs, File *file, FileInfo *finfo);
+
+Result ICACHE_FLASH_ATTR write_file(spifs_t *fs, File *file, uint8_t *buffer, uint32_t size, WriteMethod method);
+
+Result ICACHE_FLASH_ATTR write_file_v(spifs_t *fs, File *file, const SpifsIovec *iov, uint32_t iovcnt, WriteMethod method);
 
-Result ICACHE_FLASH_ATTR write_file(File *file, uint8_t *buffer, uint32_t size, WriteMethod method);
+Result ICACHE_FLASH_ATTR write_file_at(spifs_t *fs, File *file, uint32_t offset, uint8_t *buffer, uint32_t length);
 
-Result ICACHE_FLASH_ATTR write_finish(File *file);
+Result ICACHE_FLASH_ATTR write_finish(spifs_t *fs, File *file);
 
-uint32_t ICACHE_FLASH_ATTR read_file(File *file, uint32_t offset, uint8_t *buffer, uint32_t size);
+uint32_t ICACHE_FLASH_ATTR read_file(spifs_t *fs, File *file, uint32_t offset, uint8_t *buffer, uint32_t size);
 
-BOOL ICACHE_FLASH_ATTR open_file(File *file, char *filename, char *extname);
+uint32_t ICACHE_FLASH_ATTR read_file_v(spifs_t *fs, File *file, uint32_t offset, const SpifsIovec *iov, uint32_t iovcnt);
 
-BOOL ICACHE_FLASH_ATTR open_file_raw(File *file, uint8_t *filename, uint8_t *extname);
+#ifdef SPIFS_USE_MMAP
+uint32_t ICACHE_FLASH_ATTR map_file(spifs_t *fs, File *file, uint32_t offset, uint32_t length, SpifsSpan *span, uint32_t max);
+#endif
+
+BOOL ICACHE_FLASH_ATTR open_file(spifs_t *fs, File *file, char *filename, char *extname);
+
+BOOL ICACHE_FLASH_ATTR open_file_raw(spifs_t *fs, File *file, uint8_t *filename, uint8_t *extname);
+
+Result ICACHE_FLASH_ATTR rename_file(spifs_t *fs, File *file, char *filename, char *extname);
+
+Result ICACHE_FLASH_ATTR rename_file_raw(spifs_t *fs, File *file, uint8_t *filename, uint8_t *extname);
+
+void ICACHE_FLASH_ATTR delete_file(spifs_t *fs, File *file);
+
+uint32_t ICACHE_FLASH_ATTR list_file(spifs_t *fs, uint32_t *startAddr, File *files, uint32_t max);
+
+uint32_t ICACHE_FLASH_ATTR list_file_raw(spifs_t *fs, uint32_t *startAddr, uint8_t *buffer, uint32_t max);
+
+void ICACHE_FLASH_ATTR list_filter_init(SpifsListFilter *filter);
+
+uint32_t ICACHE_FLASH_ATTR list_file_filter(spifs_t *fs, SpifsListCursor *cursor, const SpifsListFilter *filter, File *files, FileInfo *finfos, uint32_t max);
+
+BOOL ICACHE_FLASH_ATTR read_finfo(spifs_t *fs, File *file, FileInfo *finfo);
+
+void ICACHE_FLASH_ATTR attach_cluster_cache(FileHandle *fh, ClusterCache *cache, uint32_t *sectors, uint16_t capacity, uint16_t interval);
 
-Result ICACHE_FLASH_ATTR rename_file(File *file, char *filename, char *extname);
+BOOL ICACHE_FLASH_ATTR open_handle(spifs_t *fs, FileHandle *fh, File *file, uint8_t mode);
 
-Result ICACHE_FLASH_ATTR rename_file_raw(File *file, uint8_t *filename, uint8_t *extname);
+uint32_t ICACHE_FLASH_ATTR read_handle(spifs_t *fs, FileHandle *fh, uint8_t *buffer, uint32_t length);
 
-void ICACHE_FLASH_ATTR delete_file(File *file);
+Result ICACHE_FLASH_ATTR write_handle(spifs_t *fs, FileHandle *fh, uint8_t *buffer, uint32_t length);
 
-uint32_t ICACHE_FLASH_ATTR list_file(uint32_t *startAddr, File *files, uint32_t max);
+BOOL ICACHE_FLASH_ATTR seek_handle(FileHandle *fh, uint32_t position);
 
-uint32_t ICACHE_FLASH_ATTR list_file_raw(uint32_t *startAddr, uint8_t *buffer, uint32_t max);
+BOOL ICACHE_FLASH_ATTR close_handle(spifs_t *fs, FileHandle *fh);
 
-BOOL ICACHE_FLASH_ATTR read_finfo(File *file, FileInfo *finfo);
+uint32_t ICACHE_FLASH_ATTR spifs_gc(spifs_t *fs, GCType tp, uint32_t nums);
 
-uint32_t ICACHE_FLASH_ATTR spifs_gc(GCType tp, uint32_t nums);
+uint32_t ICACHE_FLASH_ATTR spifs_gc_step(spifs_t *fs, uint32_t budget);
 
-void ICACHE_FLASH_ATTR spifs_ftl_init(void);
+uint32_t ICACHE_FLASH_ATTR spifs_gc_pending(spifs_t *fs);
 
-void ICACHE_FLASH_ATTR spifs_format();
+void ICACHE_FLASH_ATTR spifs_reserve_config(spifs_t *fs, uint32_t low_water);
 
-BOOL ICACHE_FLASH_ATTR spifs_erase_sector(uint32_t sec);
+BOOL ICACHE_FLASH_ATTR spifs_reserve_step(spifs_t *fs);
 
-uint32_t ICACHE_FLASH_ATTR spifs_avail_sector();
+void ICACHE_FLASH_ATTR spifs_ftl_init(spifs_t *fs);
 
-uint32_t ICACHE_FLASH_ATTR spifs_avail_files();
+void ICACHE_FLASH_ATTR spifs_format(spifs_t *fs);
+
+BOOL ICACHE_FLASH_ATTR spifs_checkpoint(spifs_t *fs);
+
+BOOL ICACHE_FLASH_ATTR spifs_erase_sector(spifs_t *fs, uint32_t sec);
+
+uint32_t ICACHE_FLASH_ATTR spifs_avail_sector(spifs_t *fs);
+
+uint32_t ICACHE_FLASH_ATTR spifs_avail_files(spifs_t *fs);
+
+uint32_t ICACHE_FLASH_ATTR spifs_erase_count(spifs_t *fs, uint32_t sec);
+
+#ifdef SPIFS_USE_STATS
+void ICACHE_FLASH_ATTR spifs_stats_snapshot(spifs_t *fs, SpifsFlashStats *stats);
+
+void ICACHE_FLASH_ATTR spifs_stats_reset(spifs_t *fs);
+#endif
+
+#ifdef SPIFS_USE_CACHE
+void ICACHE_FLASH_ATTR spifs_cache_stats(spifs_t *fs, SpifsCacheStats *stats);
+
+void ICACHE_FLASH_ATTR spifs_cache_stats_reset(spifs_t *fs);
+#endif
 
 uint16_t ICACHE_FLASH_ATTR spifs_get_version();
 
@@ -0,0 +1,197 @@
+#include "spifs_async.h"
+
+#ifdef SPIFS_USE_ASYNC
+
+#define QUEUE_LOCK(queue)      do { if((queue)->ops != NULL && (queue)->ops->lock != NULL) (queue)->ops->lock((queue)->backend); } while(0)
+#define QUEUE_UNLOCK(queue)    do { if((queue)->ops != NULL && (queue)->ops->unlock != NULL) (queue)->ops->unlock((queue)->backend); } while(0)
+
+static uint32_t ICACHE_FLASH_ATTR request_execute(spifs_t *fs, SpifsRequest *req);
+
+/**
+ * @brief 初始化请求队列
+ * @param *fs 已挂载的文件系统实例
+ * @param *ops 后端接口, 可为NULL: 提交与执行位于同一上下文, 由应用调用spifs_queue_service
+ * @param *backend 传给后端接口的参数
+ * */
+void ICACHE_FLASH_ATTR spifs_queue_init(SpifsQueue *queue, spifs_t *fs, const SpifsQueueOps *ops, void *backend) {
+    queue->fs = fs;
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->ops = ops;
+    queue->backend = backend;
+}
+
+/**
+ * @brief 提交请求, 立即返回, 请求按提交顺序执行
+ * @param *req 已填充的请求, 不能处于排队/执行中
+ * @return FALSE: 请求正在排队或执行
+ * */
+BOOL ICACHE_FLASH_ATTR spifs_queue_submit(SpifsQueue *queue, SpifsRequest *req) {
+#ifdef SPIFS_USE_NULL_CHECK
+    if(queue == NULL || req == NULL) {
+        return FALSE;
+    }
+#endif
+    QUEUE_LOCK(queue);
+    if(req->state == SPIFS_REQ_QUEUED || req->state == SPIFS_REQ_RUNNING) {
+        QUEUE_UNLOCK(queue);
+        return FALSE;
+    }
+    req->state = SPIFS_REQ_QUEUED;
+    req->next = NULL;
+    if(queue->tail == NULL) {
+        queue->head = req;
+    }else {
+        queue->tail->next = req;
+    }
+    queue->tail = req;
+    QUEUE_UNLOCK(queue);
+
+    if(queue->ops != NULL && queue->ops->kick != NULL) {
+        queue->ops->kick(queue->backend);
+    }
+    return TRUE;
+}
+
+/**
+ * @brief 执行队列中的请求, 由后端执行上下文调用, 完成后调用请求回调
+ * @param max 本次最多执行的请求数量
+ * @return 实际执行的请求数量, 0表示队列为空
+ * */
+uint32_t ICACHE_FLASH_ATTR spifs_queue_service(SpifsQueue *queue, uint32_t max) {
+    SpifsRequest *req;
+    SpifsReqCallback callback;
+    void *arg;
+    uint32_t count = 0, result;
+
+    while(count < max) {
+        QUEUE_LOCK(queue);
+        req = queue->head;
+        if(req != NULL) {
+            queue->head = req->next;
+            if(queue->head == NULL) {
+                queue->tail = NULL;
+            }
+            req->state = SPIFS_REQ_RUNNING;
+        }
+        QUEUE_UNLOCK(queue);
+        if(req == NULL) {
+            break;
+        }
+
+        result = request_execute(queue->fs, req);
+
+        // 置为完成后应用即可重用或释放请求, 回调与参数须先取出
+        callback = req->callback;
+        arg = req->arg;
+        QUEUE_LOCK(queue);
+        req->result = result;
+        req->state = SPIFS_REQ_DONE;
+        QUEUE_UNLOCK(queue);
+        if(callback != NULL) {
+            callback(req, arg);
+        }
+        count++;
+    }
+    return count;
+}
+
+/**
+ * @brief 查询队列是否为空, 执行中的请求已出队
+ * @return 无排队请求TRUE
+ * */
+BOOL ICACHE_FLASH_ATTR spifs_queue_idle(SpifsQueue *queue) {
+    BOOL idle;
+
+    QUEUE_LOCK(queue);
+    idle = (queue->head == NULL);
+    QUEUE_UNLOCK(queue);
+    return idle;
+}
+
+/**
+ * @brief 查询请求是否完成, 完成后req->result有效
+ * @brief 返回TRUE后执行上下文不再读写请求, 未设置回调的请求此时即可重新提交、修改或释放;
+ * @brief 设置了回调时执行上下文仍会以该请求指针调用回调, 需在回调返回后再释放
+ * @return 完成TRUE
+ * */
+BOOL ICACHE_FLASH_ATTR spifs_request_done(SpifsQueue *queue, SpifsRequest *req) {
+    BOOL done;
+
+    QUEUE_LOCK(queue);
+    done = (req->state == SPIFS_REQ_DONE);
+    QUEUE_UNLOCK(queue);
+    return done;
+}
+
+/**
+ * @brief 填充读文件请求
+ * */
+void ICACHE_FLASH_ATTR spifs_request_read(SpifsRequest *req, File *file, uint32_t offset, uint8_t *buffer, uint32_t length, SpifsReqCallback callback, void *arg) {
+    os_memset(req, 0x00, sizeof(SpifsRequest));
+    req->type = SPIFS_REQ_READ;
+    req->file = file;
+    req->offset = offset;
+    req->buffer = buffer;
+    req->length = length;
+    req->callback = callback;
+    req->arg = arg;
+}
+
+/**
+ * @brief 填充写文件请求
+ * */
+void ICACHE_FLASH_ATTR spifs_request_write(SpifsRequest *req, File *file, uint8_t *buffer, uint32_t length, WriteMethod method, SpifsReqCallback callback, void *arg) {
+    os_memset(req, 0x00, sizeof(SpifsRequest));
+    req->type = SPIFS_REQ_WRITE;
+    req->method = (uint8_t)method;
+    req->file = file;
+    req->buffer = buffer;
+    req->length = length;
+    req->callback = callback;
+    req->arg = arg;
+}
+
+/**
+ * @brief 填充追加写结束请求
+ * */
+void ICACHE_FLASH_ATTR spifs_request_finish(SpifsRequest *req, File *file, SpifsReqCallback callback, void *arg) {
+    os_memset(req, 0x00, sizeof(SpifsRequest));
+    req->type = SPIFS_REQ_FINISH;
+    req->file = file;
+    req->callback = callback;
+    req->arg = arg;
+}
+
+/**
+ * @brief 填充增量垃圾回收请求
+ * @param budget 最多擦除次数
+ * */
+void ICACHE_FLASH_ATTR spifs_request_gc(SpifsRequest *req, uint32_t budget, SpifsReqCallback callback, void *arg) {
+    os_memset(req, 0x00, sizeof(SpifsRequest));
+    req->type = SPIFS_REQ_GC;
+    req->length = budget;
+    req->callback = callback;
+    req->arg = arg;
+}
+
+/**
+ * @brief 执行单个请求
+ * @return 请求结果
+ * */
+static uint32_t ICACHE_FLASH_ATTR request_execute(spifs_t *fs, SpifsRequest *req) {
+    switch(req->type) {
+    case SPIFS_REQ_READ:
+        return read_file(fs, req->file, req->offset, req->buffer, req->length);
+    case SPIFS_REQ_WRITE:
+        return write_file(fs, req->file, req->buffer, req->length, (WriteMethod)req->method);
+    case SPIFS_REQ_FINISH:
+        return write_finish(fs, req->file);
+    case SPIFS_REQ_GC:
+        return spifs_gc_step(fs, req->length);
+    default:
+        return 0;
+    }
+}
+
+#endif
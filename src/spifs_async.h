@@ -0,0 +1,108 @@
+/*
+ * spifs_async.h
+ * @brief SPIFS异步请求队列
+ * 应用提交读/写/追加结束/GC请求后立即返回, 由后端执行上下文(工作线程/RTOS任务/空闲循环)调用spifs_queue_service执行
+ * 请求完成后调用回调函数, 也可由应用查询请求状态
+ * 执行上下文与应用同时直接调用SPIFS API时, 文件系统实例需配置读写锁(SPIFS_USE_LOCK)
+ */
+
+#ifndef _SPIFS_ASYNC_H_
+#define _SPIFS_ASYNC_H_
+
+#include "spifs.h"
+
+#ifdef SPIFS_USE_ASYNC
+
+/**
+ * @brief 请求类型
+ */
+typedef enum _spifs_req_type {
+    // read_file(file, offset, buffer, length), result为读出字节数
+    SPIFS_REQ_READ = 0,
+    // write_file(file, buffer, length, method), result为Result
+    SPIFS_REQ_WRITE,
+    // write_finish(file), result为Result
+    SPIFS_REQ_FINISH,
+    // spifs_gc_step(length), length为擦除次数上限, result为实际擦除次数
+    SPIFS_REQ_GC
+} SpifsReqType;
+
+/**
+ * @brief 请求状态
+ */
+typedef enum _spifs_req_state {
+    // 未提交或已被取走结果
+    SPIFS_REQ_IDLE = 0,
+    // 已提交, 等待执行
+    SPIFS_REQ_QUEUED,
+    // 执行中
+    SPIFS_REQ_RUNNING,
+    // 已完成, result有效, 执行上下文不再访问请求
+    SPIFS_REQ_DONE
+} SpifsReqState;
+
+typedef struct _spifs_request SpifsRequest;
+
+// 完成回调, 在执行上下文中调用, 回调中可重新提交同一请求
+typedef void (*SpifsReqCallback)(SpifsRequest *req, void *arg);
+
+/**
+ * @brief 异步请求, 由调用者分配, 完成前不能释放或修改, File与缓冲区同样需保持有效
+ */
+struct _spifs_request {
+    uint8_t type;                // SpifsReqType
+    uint8_t method;              // SPIFS_REQ_WRITE: WriteMethod
+    volatile uint8_t state;      // SpifsReqState
+    File *file;
+    uint32_t offset;             // SPIFS_REQ_READ: 文件偏移量
+    uint8_t *buffer;
+    uint32_t length;             // 读写字节数, SPIFS_REQ_GC: 擦除次数上限
+    uint32_t result;
+    SpifsReqCallback callback;   // 可为NULL, 由应用查询状态
+    void *arg;
+    SpifsRequest *next;
+};
+
+/**
+ * @brief 队列后端接口, 由执行上下文实现, 主机测试可使用spifs_port_posix.c的工作线程实现
+ */
+typedef struct _spifs_queue_ops {
+    // 队列互斥, 提交与执行位于同一上下文时可为NULL
+    void (*lock)(void *backend);
+    void (*unlock)(void *backend);
+    // 有新请求提交, 唤醒执行上下文; 可为NULL, 由应用周期调用spifs_queue_service
+    void (*kick)(void *backend);
+} SpifsQueueOps;
+
+/**
+ * @brief 请求队列, 先进先出
+ */
+typedef struct _spifs_queue {
+    spifs_t *fs;
+    SpifsRequest *head;
+    SpifsRequest *tail;
+    const SpifsQueueOps *ops;
+    void *backend;
+} SpifsQueue;
+
+void ICACHE_FLASH_ATTR spifs_queue_init(SpifsQueue *queue, spifs_t *fs, const SpifsQueueOps *ops, void *backend);
+
+BOOL ICACHE_FLASH_ATTR spifs_queue_submit(SpifsQueue *queue, SpifsRequest *req);
+
+uint32_t ICACHE_FLASH_ATTR spifs_queue_service(SpifsQueue *queue, uint32_t max);
+
+BOOL ICACHE_FLASH_ATTR spifs_queue_idle(SpifsQueue *queue);
+
+BOOL ICACHE_FLASH_ATTR spifs_request_done(SpifsQueue *queue, SpifsRequest *req);
+
+void ICACHE_FLASH_ATTR spifs_request_read(SpifsRequest *req, File *file, uint32_t offset, uint8_t *buffer, uint32_t length, SpifsReqCallback callback, void *arg);
+
+void ICACHE_FLASH_ATTR spifs_request_write(SpifsRequest *req, File *file, uint8_t *buffer, uint32_t length, WriteMethod method, SpifsReqCallback callback, void *arg);
+
+void ICACHE_FLASH_ATTR spifs_request_finish(SpifsRequest *req, File *file, SpifsReqCallback callback, void *arg);
+
+void ICACHE_FLASH_ATTR spifs_request_gc(SpifsRequest *req, uint32_t budget, SpifsReqCallback callback, void *arg);
+
+#endif
+
+#endif
@@ -0,0 +1,263 @@
+/*
+ * spifs_port_posix.c
+ * @brief SPIFS移植层的pthread实现
+ */
+
+#include <time.h>
+#include "spifs_port_posix.h"
+
+#ifdef SPIFS_USE_LOCK
+
+// flash总线互斥锁, 所有使用SPIFS_POSIX_FLASH_OPS的实例共享
+static pthread_mutex_t bus_lock = PTHREAD_MUTEX_INITIALIZER;
+// 读缓存互斥锁, 所有使用SPIFS_POSIX_LOCK_OPS的实例共享, 仅在缓存查找/载入期间持有
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+// 模拟器虚拟时钟(ns), NULL时不模拟flash耗时
+static uint64_t (*bus_clock)(void) = NULL;
+
+static void bus_enter(uint64_t *start);
+static void bus_leave(uint64_t start);
+
+/**
+ * @brief 初始化读写锁, glibc下设置为写锁优先
+ * @param *lock 读写锁, 作为SpifsConfig.lock传入
+ * @return 成功TRUE
+ * */
+BOOL spifs_posix_lock_init(pthread_rwlock_t *lock) {
+    pthread_rwlockattr_t attr;
+    int ret;
+
+    if(pthread_rwlockattr_init(&attr) != 0) {
+        return FALSE;
+    }
+#ifdef __GLIBC__
+    // glibc默认读优先, 读者持续到达时写者无法获得锁
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    ret = pthread_rwlock_init(lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    return (ret == 0);
+}
+
+/**
+ * @brief 销毁读写锁, 需在spifs_unmount之后调用
+ * */
+void spifs_posix_lock_destroy(pthread_rwlock_t *lock) {
+    pthread_rwlock_destroy(lock);
+}
+
+static void posix_read_lock(void *lock) {
+    pthread_rwlock_rdlock((pthread_rwlock_t *)lock);
+}
+
+static void posix_read_unlock(void *lock) {
+    pthread_rwlock_unlock((pthread_rwlock_t *)lock);
+}
+
+static void posix_write_lock(void *lock) {
+    pthread_rwlock_wrlock((pthread_rwlock_t *)lock);
+}
+
+static void posix_write_unlock(void *lock) {
+    pthread_rwlock_unlock((pthread_rwlock_t *)lock);
+}
+
+static void posix_mutex_lock(void *lock) {
+    pthread_mutex_lock(&cache_lock);
+}
+
+static void posix_mutex_unlock(void *lock) {
+    pthread_mutex_unlock(&cache_lock);
+}
+
+const SpifsLockOps SPIFS_POSIX_LOCK_OPS = {
+    posix_read_lock,
+    posix_read_unlock,
+    posix_write_lock,
+    posix_write_unlock,
+    posix_mutex_lock,
+    posix_mutex_unlock
+};
+
+static SpiFlashOpResult posix_flash_read(void *flash, uint32_t addr, uint32_t *buffer, uint32_t size) {
+    SpiFlashOpResult ret;
+    uint64_t start;
+
+    bus_enter(&start);
+    ret = SPIFS_SPI_FLASH_OPS.read(flash, addr, buffer, size);
+    bus_leave(start);
+    return ret;
+}
+
+static SpiFlashOpResult posix_flash_write(void *flash, uint32_t addr, uint32_t *buffer, uint32_t size) {
+    SpiFlashOpResult ret;
+    uint64_t start;
+
+    bus_enter(&start);
+    ret = SPIFS_SPI_FLASH_OPS.write(flash, addr, buffer, size);
+    bus_leave(start);
+    return ret;
+}
+
+static SpiFlashOpResult posix_flash_erase(void *flash, uint32_t sec) {
+    SpiFlashOpResult ret;
+    uint64_t start;
+
+    bus_enter(&start);
+    ret = SPIFS_SPI_FLASH_OPS.erase(flash, sec);
+    bus_leave(start);
+    return ret;
+}
+
+static SpiFlashOpResult posix_flash_erase_start(void *flash, uint32_t sec) {
+    SpiFlashOpResult ret;
+    uint64_t start;
+
+    bus_enter(&start);
+    ret = SPIFS_SPI_FLASH_OPS.erase_start(flash, sec);
+    bus_leave(start);
+    return ret;
+}
+
+static uint8_t posix_flash_busy(void *flash) {
+    uint8_t ret;
+    uint64_t start;
+
+    bus_enter(&start);
+    ret = SPIFS_SPI_FLASH_OPS.busy(flash);
+    bus_leave(start);
+    return ret;
+}
+
+static SpiFlashOpResult posix_flash_erase_block(void *flash, uint32_t sec, uint32_t secs) {
+    SpiFlashOpResult ret;
+    uint64_t start;
+
+    bus_enter(&start);
+    ret = SPIFS_SPI_FLASH_OPS.erase_block(flash, sec, secs);
+    bus_leave(start);
+    return ret;
+}
+
+const SpifsFlashOps SPIFS_POSIX_FLASH_OPS = {
+    posix_flash_read,
+    posix_flash_write,
+    posix_flash_erase,
+    posix_flash_erase_start,
+    posix_flash_busy,
+    posix_flash_erase_block
+};
+
+/**
+ * @brief 设置模拟flash耗时, 每次flash操作按其推进的虚拟时间休眠, 休眠期间占用总线
+ * @param clock 虚拟时钟(ns), 如w25q32_clock; NULL:不模拟
+ * */
+void spifs_posix_flash_latency(uint64_t (*clock)(void)) {
+    pthread_mutex_lock(&bus_lock);
+    bus_clock = clock;
+    pthread_mutex_unlock(&bus_lock);
+}
+
+static void bus_enter(uint64_t *start) {
+    pthread_mutex_lock(&bus_lock);
+    *start = (bus_clock != NULL) ? bus_clock() : 0;
+}
+
+static void bus_leave(uint64_t start) {
+    struct timespec ts;
+    uint64_t elapsed;
+
+    if(bus_clock != NULL) {
+        elapsed = bus_clock() - start;
+        ts.tv_sec = (time_t)(elapsed / 1000000000ULL);
+        ts.tv_nsec = (long)(elapsed % 1000000000ULL);
+        nanosleep(&ts, NULL);
+    }
+    pthread_mutex_unlock(&bus_lock);
+}
+
+#ifdef SPIFS_USE_ASYNC
+static void *posix_worker_main(void *arg);
+
+static void posix_queue_lock(void *backend) {
+    pthread_mutex_lock(&((SpifsPosixWorker *)backend)->mutex);
+}
+
+static void posix_queue_unlock(void *backend) {
+    pthread_mutex_unlock(&((SpifsPosixWorker *)backend)->mutex);
+}
+
+static void posix_queue_kick(void *backend) {
+    SpifsPosixWorker *worker = (SpifsPosixWorker *)backend;
+
+    pthread_mutex_lock(&worker->mutex);
+    pthread_cond_signal(&worker->cond);
+    pthread_mutex_unlock(&worker->mutex);
+}
+
+const SpifsQueueOps SPIFS_POSIX_QUEUE_OPS = {
+    posix_queue_lock,
+    posix_queue_unlock,
+    posix_queue_kick
+};
+
+/**
+ * @brief 初始化队列并启动工作线程
+ * @param *worker 工作线程, 作为队列后端参数
+ * @param *queue 请求队列, 由本函数初始化
+ * @param *fs 已挂载的文件系统实例, 应用线程同时访问时需配置读写锁
+ * @return 成功TRUE
+ * */
+BOOL spifs_posix_worker_start(SpifsPosixWorker *worker, SpifsQueue *queue, spifs_t *fs) {
+    if(pthread_mutex_init(&worker->mutex, NULL) != 0) {
+        return FALSE;
+    }
+    if(pthread_cond_init(&worker->cond, NULL) != 0) {
+        pthread_mutex_destroy(&worker->mutex);
+        return FALSE;
+    }
+    worker->queue = queue;
+    worker->stop = FALSE;
+    spifs_queue_init(queue, fs, &SPIFS_POSIX_QUEUE_OPS, worker);
+    if(pthread_create(&worker->thread, NULL, posix_worker_main, worker) != 0) {
+        pthread_cond_destroy(&worker->cond);
+        pthread_mutex_destroy(&worker->mutex);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief 执行完已提交的请求后停止工作线程
+ * */
+void spifs_posix_worker_stop(SpifsPosixWorker *worker) {
+    pthread_mutex_lock(&worker->mutex);
+    worker->stop = TRUE;
+    pthread_cond_signal(&worker->cond);
+    pthread_mutex_unlock(&worker->mutex);
+    pthread_join(worker->thread, NULL);
+    pthread_cond_destroy(&worker->cond);
+    pthread_mutex_destroy(&worker->mutex);
+}
+
+static void *posix_worker_main(void *arg) {
+    SpifsPosixWorker *worker = (SpifsPosixWorker *)arg;
+
+    pthread_mutex_lock(&worker->mutex);
+    for(;;) {
+        if(worker->queue->head != NULL) {
+            pthread_mutex_unlock(&worker->mutex);
+            spifs_queue_service(worker->queue, 1);
+            pthread_mutex_lock(&worker->mutex);
+        }else if(worker->stop) {
+            break;
+        }else {
+            pthread_cond_wait(&worker->cond, &worker->mutex);
+        }
+    }
+    pthread_mutex_unlock(&worker->mutex);
+    return NULL;
+}
+#endif
+
+#endif
@@ -0,0 +1,51 @@
+/*
+ * spifs_port_posix.h
+ * @brief SPIFS移植层的pthread实现, 用于主机测试或Linux平台多线程访问
+ * 读写锁: 读锁共享/写锁独占, 写锁优先, 持续读取时写入不会饿死; 读缓存互斥锁为进程内共享的pthread互斥量
+ * flash总线锁: 转发到默认flash操作接口, 多个读者并发时串行访问flash, 可按模拟器虚拟时钟休眠以模拟flash耗时
+ * 异步队列工作线程: 等待请求提交后执行, flash耗时期间应用线程可继续运行
+ */
+
+#ifndef _SPIFS_PORT_POSIX_H_
+#define _SPIFS_PORT_POSIX_H_
+
+#include "spifs.h"
+#include "spifs_async.h"
+
+#ifdef SPIFS_USE_LOCK
+#include <pthread.h>
+
+// 读写锁接口, lock参数为spifs_posix_lock_init初始化的pthread_rwlock_t
+extern const SpifsLockOps SPIFS_POSIX_LOCK_OPS;
+
+// 带总线互斥的默认flash操作接口, flash参数未使用
+extern const SpifsFlashOps SPIFS_POSIX_FLASH_OPS;
+
+BOOL spifs_posix_lock_init(pthread_rwlock_t *lock);
+
+void spifs_posix_lock_destroy(pthread_rwlock_t *lock);
+
+void spifs_posix_flash_latency(uint64_t (*clock)(void));
+
+#ifdef SPIFS_USE_ASYNC
+/**
+ * @brief 异步队列工作线程, 作为队列后端参数
+ */
+typedef struct _spifs_posix_worker {
+    pthread_t thread;
+    pthread_mutex_t mutex;          // 队列互斥
+    pthread_cond_t cond;            // 请求提交/停止通知
+    SpifsQueue *queue;
+    BOOL stop;
+} SpifsPosixWorker;
+
+// 队列后端接口, backend参数为SpifsPosixWorker
+extern const SpifsQueueOps SPIFS_POSIX_QUEUE_OPS;
+
+BOOL spifs_posix_worker_start(SpifsPosixWorker *worker, SpifsQueue *queue, spifs_t *fs);
+
+void spifs_posix_worker_stop(SpifsPosixWorker *worker);
+#endif
+#endif
+
+#endif
@@ -2,6 +2,49 @@
 
 static uint8_t *w25q32_buffer = NULL;
 
+// 进行中的扇区擦除地址, 剩余BUSY查询次数, 为0时空闲
+static uint32_t erase_address = 0;
+static uint32_t erase_polls = 0;
+
+#ifdef W25Q32_USE_TIMING
+// 命令字节数: 指令1字节 + 地址3字节
+#define CMD_ADDR_BYTES    4
+
+static W25q32Timing timing = {
+    40000000,   // 40MHz
+    1000,       // 1us
+    W25Q32_PAGE_SIZE,
+    700,        // tPP 0.7ms
+    45000,      // tSE 45ms
+    10000000,   // tCE 10s
+    120000,     // tBE1 120ms
+    150000      // tBE2 150ms
+};
+
+static W25q32Stats stats;
+
+// 后台擦除完成时刻(ns)
+static uint64_t erase_done_ns = 0;
+
+/**
+ * @brief 推进虚拟时钟: 命令固定开销 + 总线传输bytes字节
+ * @param bytes 总线传输字节数(含指令/地址)
+ * */
+static void bus_transfer(uint32_t bytes) {
+    stats.clock_ns += timing.cmd_overhead_ns;
+    stats.clock_ns += ((uint64_t)bytes * 8 * 1000000000) / timing.bus_hz;
+}
+
+/**
+ * @brief 推进虚拟时钟: 等待芯片内部编程/擦除完成
+ * @param us 耗时(us)
+ * */
+static void busy_wait(uint32_t us) {
+    stats.clock_ns += (uint64_t)us * 1000;
+    stats.busy_ns += (uint64_t)us * 1000;
+}
+#endif
+
 void w25q32_allocate() {
     if(w25q32_buffer == NULL) {
         w25q32_buffer = (uint8_t *)malloc(sizeof(uint8_t) * W25Q32_SIZE);
@@ -40,6 +83,13 @@ uint8_t w25q32_output(const char *filePath, const char *mode, uint32_t offset, u
  * @return state register
  * */
 uint8_t w25q32_chip_erase() {
+#ifdef W25Q32_USE_TIMING
+    // 写使能 + 擦除指令
+    bus_transfer(1);
+    bus_transfer(1);
+    busy_wait(timing.chip_erase_us);
+    stats.chip_erases++;
+#endif
     memset(w25q32_buffer, 0xFF, W25Q32_SIZE);
 	return 0x2;
 }
@@ -50,10 +100,81 @@ uint8_t w25q32_chip_erase() {
  * @return state register
  * */
 uint8_t w25q32_sector_erase(uint32_t address) {
+#ifdef W25Q32_USE_TIMING
+    bus_transfer(1);
+    bus_transfer(CMD_ADDR_BYTES);
+    busy_wait(timing.sector_erase_us);
+    stats.sector_erases++;
+#endif
     memset((w25q32_buffer + address), 0xFF, 4096);
 	return 0x2;
 }
 
+/**
+ * @brief 块擦除 32KB/64KB, 按字节计耗时远低于逐扇区擦除
+ * @param address 块起始地址, 需按块大小对齐
+ * @param size 块大小, W25Q32_BLOCK32_SIZE或W25Q32_BLOCK64_SIZE
+ * @return state register, 参数无效时返回0
+ * */
+uint8_t w25q32_block_erase(uint32_t address, uint32_t size) {
+    if(((size != W25Q32_BLOCK32_SIZE) && (size != W25Q32_BLOCK64_SIZE)) || ((address % size) != 0)
+            || ((address + size) > W25Q32_SIZE)) {
+        return 0x0;
+    }
+#ifdef W25Q32_USE_TIMING
+    bus_transfer(1);
+    bus_transfer(CMD_ADDR_BYTES);
+    busy_wait((size == W25Q32_BLOCK64_SIZE) ? timing.block64_erase_us : timing.block32_erase_us);
+    stats.block_erases++;
+#endif
+    memset((w25q32_buffer + address), 0xFF, size);
+	return 0x2;
+}
+
+/**
+ * @brief 发起扇区擦除 4KB, 立即返回
+ * @brief 启用时序模型时虚拟时钟经过tSE后擦除完成, 否则在之后的W25Q32_ERASE_POLLS次BUSY查询内完成
+ * @param address 扇区起始地址
+ * @return state register, BUSY位置位
+ * */
+uint8_t w25q32_sector_erase_start(uint32_t address) {
+    // 上一次擦除未结束时等待其完成
+    while(w25q32_busy() & W25Q32_STATUS_BUSY);
+    erase_address = address;
+    erase_polls = W25Q32_ERASE_POLLS;
+#ifdef W25Q32_USE_TIMING
+    bus_transfer(1);
+    bus_transfer(CMD_ADDR_BYTES);
+    erase_done_ns = stats.clock_ns + (uint64_t)timing.sector_erase_us * 1000;
+    stats.sector_erases++;
+#endif
+    return (0x2 | W25Q32_STATUS_BUSY);
+}
+
+/**
+ * @brief 读状态寄存器BUSY位, 每次查询推进进行中的擦除
+ * @return state register, 擦除进行中时BUSY位置位
+ * */
+uint8_t w25q32_busy() {
+    if(erase_polls == 0) {
+        return 0x0;
+    }
+#ifdef W25Q32_USE_TIMING
+    // 读状态寄存器: 指令1字节 + 状态1字节
+    bus_transfer(2);
+    stats.status_polls++;
+    if(stats.clock_ns < erase_done_ns) {
+        return W25Q32_STATUS_BUSY;
+    }
+    erase_polls = 1;
+#endif
+    if(--erase_polls == 0) {
+        memset((w25q32_buffer + erase_address), 0xFF, 4096);
+        return 0x0;
+    }
+    return W25Q32_STATUS_BUSY;
+}
+
 /**
  * @brief 四字节对齐读flash
  * @param src_addr flash地址, 四字节边界
@@ -61,6 +182,11 @@ uint8_t w25q32_sector_erase(uint32_t address) {
  * @param size 读取长度, 单位byte, 需要四字节对齐
  */
 void w25q32_read_align(uint32_t src_addr, uint32_t *des_addr, uint32_t size) {
+#ifdef W25Q32_USE_TIMING
+    bus_transfer(CMD_ADDR_BYTES + size);
+    stats.read_cmds++;
+    stats.read_bytes += size;
+#endif
     memcpy(des_addr, (w25q32_buffer + src_addr), size);
 }
 
@@ -71,5 +197,96 @@ void w25q32_read_align(uint32_t src_addr, uint32_t *des_addr, uint32_t size) {
  * @param size 写长度, 单位byte, 需要四字节对齐
  */
 void w25q32_write_align(uint32_t des_addr, uint32_t *src_addr, uint32_t size) {
-    memcpy((w25q32_buffer + des_addr), src_addr, size);
+    uint8_t *src = (uint8_t *)src_addr;
+    uint32_t i, chunk;
+
+    while(size > 0) {
+        // 页编程不能跨越页边界
+        chunk = W25Q32_PAGE_SIZE - (des_addr % W25Q32_PAGE_SIZE);
+#ifdef W25Q32_USE_TIMING
+        chunk = timing.page_size - (des_addr % timing.page_size);
+#endif
+        chunk = (size < chunk) ? size : chunk;
+#ifdef W25Q32_USE_TIMING
+        bus_transfer(1);
+        bus_transfer(CMD_ADDR_BYTES + chunk);
+        busy_wait(timing.page_program_us);
+        stats.program_cmds++;
+        stats.program_bytes += chunk;
+#endif
+        // NOR编程只能将1写为0
+        for(i = 0; i < chunk; i++) {
+            w25q32_buffer[des_addr + i] &= src[i];
+        }
+        des_addr += chunk;
+        src += chunk;
+        size -= chunk;
+    }
+}
+
+/**
+ * @brief 设置时序参数
+ * @param *timing 时序参数
+ * */
+void w25q32_timing_set(const W25q32Timing *t) {
+#ifdef W25Q32_USE_TIMING
+    timing = *t;
+#endif
+}
+
+/**
+ * @brief 读取当前时序参数
+ * @param *timing 时序参数
+ * */
+void w25q32_timing_get(W25q32Timing *t) {
+#ifdef W25Q32_USE_TIMING
+    *t = timing;
+#else
+    memset(t, 0, sizeof(W25q32Timing));
+#endif
+}
+
+/**
+ * @brief 读取虚拟时钟与操作计数
+ * @param *stats 统计信息
+ * */
+void w25q32_stats_get(W25q32Stats *s) {
+#ifdef W25Q32_USE_TIMING
+    *s = stats;
+#else
+    memset(s, 0, sizeof(W25q32Stats));
+#endif
+}
+
+/**
+ * @brief 清零操作计数, 虚拟时钟不回退
+ * */
+void w25q32_stats_reset() {
+#ifdef W25Q32_USE_TIMING
+    uint64_t clock = stats.clock_ns;
+    memset(&stats, 0, sizeof(W25q32Stats));
+    stats.clock_ns = clock;
+#endif
+}
+
+/**
+ * @brief 读取虚拟时钟
+ * @return 虚拟时钟(ns)
+ * */
+uint64_t w25q32_clock() {
+#ifdef W25Q32_USE_TIMING
+    return stats.clock_ns;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief 推进虚拟时钟, 用于模拟应用层空闲/计算耗时
+ * @param ns 推进时间(ns)
+ * */
+void w25q32_clock_advance(uint64_t ns) {
+#ifdef W25Q32_USE_TIMING
+    stats.clock_ns += ns;
+#endif
 }
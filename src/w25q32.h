@@ -9,6 +9,63 @@
 // 4MB
 #define W25Q32_SIZE        4*1024*1024
 #define W25Q32_FLASH_ID    0x401615
+// 状态寄存器BUSY位
+#define W25Q32_STATUS_BUSY 0x1
+// 模拟扇区擦除耗时, 发起擦除后查询BUSY的次数(未启用时序模型时)
+#define W25Q32_ERASE_POLLS 4
+// 页编程边界
+#define W25Q32_PAGE_SIZE   256
+// 块擦除大小, 32KB块擦除(52h)/64KB块擦除(D8h)
+#define W25Q32_BLOCK32_SIZE    (32*1024)
+#define W25Q32_BLOCK64_SIZE    (64*1024)
+
+// 使用时序模型, 按命令/总线时钟/编程/擦除耗时推进虚拟时钟并统计各操作次数
+// 默认关闭, 由编译选项-DW25Q32_USE_TIMING启用, make bench自动启用
+// #define W25Q32_USE_TIMING
+
+/**
+ * @brief 时序参数, 默认值取自W25Q32数据手册典型值
+ */
+typedef struct _w25q32_timing {
+    // SPI总线时钟(Hz)
+    uint32_t bus_hz;
+    // 每条命令固定开销(ns), 片选/驱动调用等
+    uint32_t cmd_overhead_ns;
+    // 页编程边界(字节), 跨边界的写入拆分为多条页编程命令
+    uint32_t page_size;
+    // 页编程耗时tPP(us)
+    uint32_t page_program_us;
+    // 扇区擦除耗时tSE(us)
+    uint32_t sector_erase_us;
+    // 整片擦除耗时tCE(us)
+    uint32_t chip_erase_us;
+    // 32KB/64KB块擦除耗时tBE1/tBE2(us)
+    uint32_t block32_erase_us;
+    uint32_t block64_erase_us;
+} W25q32Timing;
+
+/**
+ * @brief 虚拟时钟与操作计数
+ */
+typedef struct _w25q32_stats {
+    // 虚拟时钟(ns)
+    uint64_t clock_ns;
+    // 等待BUSY耗时(ns)
+    uint64_t busy_ns;
+    // 读命令次数/字节数
+    uint32_t read_cmds;
+    uint32_t read_bytes;
+    // 页编程命令次数/字节数
+    uint32_t program_cmds;
+    uint32_t program_bytes;
+    // 扇区擦除/整片擦除次数
+    uint32_t sector_erases;
+    uint32_t chip_erases;
+    // 块擦除次数(32KB/64KB)
+    uint32_t block_erases;
+    // 读状态寄存器次数
+    uint32_t status_polls;
+} W25q32Stats;
 
 void w25q32_allocate();
 void w25q32_destory();
@@ -21,5 +78,15 @@ void w25q32_write_align(uint32_t des_addr, uint32_t *src_addr, uint32_t size);
 
 uint8_t w25q32_chip_erase();
 uint8_t w25q32_sector_erase(uint32_t address);
+uint8_t w25q32_sector_erase_start(uint32_t address);
+uint8_t w25q32_block_erase(uint32_t address, uint32_t size);
+uint8_t w25q32_busy();
+
+void w25q32_timing_set(const W25q32Timing *timing);
+void w25q32_timing_get(W25q32Timing *timing);
+void w25q32_stats_get(W25q32Stats *stats);
+void w25q32_stats_reset();
+uint64_t w25q32_clock();
+void w25q32_clock_advance(uint64_t ns);
 
 #endif